@@ -1,10 +1,13 @@
 #ifndef BLOCKINGTHREADSAFEQUEUE_H_
 #define BLOCKINGTHREADSAFEQUEUE_H_
 
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <atomic>
+#include <boost/lockfree/detail/branch_hints.hpp>
 
+using boost::lockfree::detail::unlikely;
 using size_t = std::size_t;
 
 template<typename T, typename QueueType>
@@ -22,14 +25,16 @@ public:
 	{
 		bool result = queue.push(element);
 		if(unlikely(shouldNotify() && result))
-			condition.notify_one();
+			notifyReader();
+		return result;
 	}
 	
 	bool push(T&& element)
 	{
 		bool result = queue.push(std::move(element));
 		if(unlikely(shouldNotify() && result))
-			condition.notify_one();
+			notifyReader();
+		return result;
 	}
 	
 	bool pop()
@@ -37,38 +42,68 @@ public:
 		return queue.pop();
 	}
 	
-	bool popOnSuccses(const std::function<bool(const T&)>& function)
+	template<typename Functor>
+	bool popOnSuccses(const Functor& function)
 	{
 		return queue.popOnSuccses(function);
 	}
 	
-	void consumeAll(const std::function<void(const T&)>& function)
+	template<typename Functor>
+	size_t consumeAll(const Functor& function)
 	{
-		queue.consumeAll(function);
+		return queue.consumeAll(function);
+	}
+
+	template<typename Functor>
+	size_t consumeUpTo(const size_t max, const Functor& function)
+	{
+		return queue.consumeUpTo(max, function);
+	}
+
+	template<typename Functor>
+	size_t consumeFor(const std::chrono::nanoseconds budget, const Functor& function)
+	{
+		return queue.consumeFor(budget, function);
 	}
 	
-	void blockingConsumeAll(const std::function<void(const T&)>& function)
+	//waits until the queue holds notify_size elements or notifyReaders was called , then consumes what is there
+	template<typename Functor>
+	size_t blockingConsumeAll(const Functor& function)
 	{
-		std::unique_lock<std::mutex> lock(locker);
-		condition.wait(lock, [&]() {
-			return (!is_queue_alive.load(std::memory_order_acquire) || !shouldNotify());
-		});
-		consumeAll(function);
+		{
+			std::unique_lock<std::mutex> lock(locker);
+			condition.wait(lock, [&]() {
+				return (!is_queue_alive.load(std::memory_order_acquire) || shouldNotify());
+			});
+		}
+		return consumeAll(function);
 	}
 
-	void notifyReaders() override
+	void notifyReaders()
 	{
-		is_queue_alive.store(false, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(locker);
+			is_queue_alive.store(false, std::memory_order_release);
+		}
 		condition.notify_all();
 	}
 	
-	const size_t getSize() const override
+	const size_t getSize() const
 	{
-		queue.getSize();
+		return queue.getSize();
 	}
 
 private:
 
+	//taking the lock orders the notify after a reader that is between checking the size and waiting
+	void notifyReader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(locker);
+		}
+		condition.notify_one();
+	}
+
 	bool shouldNotify() const
 	{
 		return notify_size <= getSize();			
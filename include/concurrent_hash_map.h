@@ -0,0 +1,489 @@
+#ifndef CONCURRENTHASHMAP_H_
+#define CONCURRENTHASHMAP_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include "cyclic_buffer.h"
+#include "memory_reclamation.h"
+
+#define DEFAULT_MAP_CAPACITY 1024
+
+/*
+ * open addressing hash map with linear probing , keys and values must be trivially copyable
+ * find never takes a lock , it reads values under a per slot sequence lock
+ * insert and erase lock only the slot they change
+ * when the table passes 3/4 usage a bigger table is linked and every writer migrates a chunk of slots before it
+ * writes , readers keep working on the old table and follow moved slots into the new one
+ * replaced tables are retired to the map's EpochDomain , every operation pins it while it walks the tables
+ */
+template <class K, class V, class Hash = std::hash<K>>
+class ConcurrentHashMap
+{
+	static_assert(std::is_trivially_copyable<K>::value, "ConcurrentHashMap keys must be trivially copyable");
+	static_assert(std::is_trivially_copyable<V>::value, "ConcurrentHashMap values must be trivially copyable");
+
+public:
+
+	ConcurrentHashMap(const size_t _capacity = DEFAULT_MAP_CAPACITY)
+	: current_table(new Table(roundCapacity(_capacity)))
+	, elements_count(0)
+	{
+	}
+
+	ConcurrentHashMap(ConcurrentHashMap&) = delete;
+	ConcurrentHashMap(ConcurrentHashMap&&) = delete;
+
+	~ConcurrentHashMap()
+	{
+		Table * table = current_table.load(MEM_RELAXED);
+		while(table != nullptr)
+		{
+			Table * next = table->next.load(MEM_RELAXED);
+			delete table;
+			table = next;
+		}
+	}
+
+	//inserts the key or assigns value to an existing key , returns true when the key was not in the map
+	bool insert(const K& key, const V& value)
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		Table * table = current_table.load(MEM_ACQUIRE);
+		while(true)
+		{
+			table = prepareWrite(table, key);
+			const WriteResult result = assign(table, key, value, false);
+			if(likely(result != WriteResult::Retry))
+			{
+				if(result == WriteResult::Inserted)
+					elements_count.fetch_add(1, MEM_RELAXED);
+				return result == WriteResult::Inserted;
+			}
+		}
+	}
+
+	//returns true and removes the key when it was in the map otherwise false
+	bool erase(const K& key)
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		Table * table = current_table.load(MEM_ACQUIRE);
+		while(true)
+		{
+			table = prepareWrite(table, key);
+			const WriteResult result = remove(table, key);
+			if(likely(result != WriteResult::Retry))
+			{
+				if(result == WriteResult::Erased)
+					elements_count.fetch_sub(1, MEM_RELAXED);
+				return result == WriteResult::Erased;
+			}
+		}
+	}
+
+	//this function will not block , returns true and fills value when the key is in the map otherwise false
+	bool find(const K& key, V& value) const
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		const size_t hash = hashKey(key);
+		for(Table * table = current_table.load(MEM_ACQUIRE); ; table = table->next.load(MEM_ACQUIRE))
+		{
+			const ReadResult result = find(table, hash, key, value);
+			if(likely(result != ReadResult::Moved))
+				return result == ReadResult::Found;
+		}
+	}
+
+	bool contains(const K& key) const
+	{
+		V value;
+		return find(key, value);
+	}
+
+	const size_t size() const
+	{
+		return elements_count.load(MEM_RELAXED);
+	}
+
+	const size_t capacity() const
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		Table * table = current_table.load(MEM_ACQUIRE);
+		for(Table * next = table->next.load(MEM_ACQUIRE); next != nullptr; next = table->next.load(MEM_ACQUIRE))
+			table = next;
+		return table->capacity;
+	}
+
+private:
+
+	enum SlotState : uint32_t
+	{
+		Empty = 0,
+		Full = 1,
+		Deleted = 2,
+		Moved = 4
+	};
+
+	enum class ReadResult
+	{
+		Found,
+		Absent,
+		Moved
+	};
+
+	enum class WriteResult
+	{
+		Inserted,
+		Updated,
+		Present,
+		Erased,
+		Absent,
+		Retry
+	};
+
+	/*
+	 * version is a sequence lock , odd while a writer owns the slot
+	 * the key is written once while the slot is locked and empty , after that it never changes
+	 */
+	struct Slot
+	{
+		std::atomic<uint32_t> version;
+		std::atomic<uint32_t> state;
+		K key;
+		V value;
+	};
+
+	static const size_t migration_chunk = 256;
+	static const int padding_size = CACHE_LINE_SIZE - sizeof(std::atomic<size_t>);
+
+	struct Table
+	{
+		Table(const size_t _capacity)
+		: capacity(_capacity)
+		, mask(_capacity - 1)
+		, max_used(_capacity - _capacity / 4)
+		, slots(static_cast<Slot *>(::operator new(sizeof(Slot) * _capacity, std::align_val_t(CACHE_LINE_SIZE))))
+		, next(nullptr)
+		, used(0)
+		, migrate_position(0)
+		, migrated(0)
+		{
+			for(size_t i = 0; i < capacity; ++i)
+			{
+				new (&slots[i].version) std::atomic<uint32_t>(0);
+				new (&slots[i].state) std::atomic<uint32_t>(Empty);
+			}
+		}
+
+		~Table()
+		{
+			::operator delete(slots, std::align_val_t(CACHE_LINE_SIZE));
+		}
+
+		const size_t capacity;
+		const size_t mask;
+		const size_t max_used;
+		Slot * const slots;
+		std::atomic<Table *> next;
+		char padding1[padding_size]; /* keep the counters that every writer touches away from the read only fields */
+		std::atomic<size_t> used;
+		char padding2[padding_size];
+		std::atomic<size_t> migrate_position;
+		std::atomic<size_t> migrated;
+	};
+
+	static const size_t roundCapacity(const size_t capacity)
+	{
+		size_t ret = 16;
+		while(ret < capacity)
+			ret *= 2;
+		return ret;
+	}
+
+	static const size_t hashKey(const K& key)
+	{
+		uint64_t hash = Hash()(key);
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	static const uint32_t lockSlot(Slot& slot)
+	{
+		uint32_t version = slot.version.load(MEM_RELAXED);
+		while((version & 1) != 0 ||
+				!slot.version.compare_exchange_weak(version, version + 1, MEM_ACQUIRE, MEM_RELAXED))
+			version = slot.version.load(MEM_RELAXED);
+		std::atomic_thread_fence(MEM_RELEASE);
+		return version + 1;
+	}
+
+	static void unlockSlot(Slot& slot, const uint32_t locked_version)
+	{
+		slot.version.store(locked_version + 1, MEM_RELEASE);
+	}
+
+	ReadResult find(const Table * table, const size_t hash, const K& key, V& value) const
+	{
+		for(size_t index = hash & table->mask; ; index = (index + 1) & table->mask)
+		{
+			Slot& slot = table->slots[index];
+			const uint32_t state = slot.state.load(MEM_ACQUIRE);
+			if(state == Empty)
+				return ReadResult::Absent;
+			if(state == (Moved | Empty))
+				return ReadResult::Moved;
+			if(!(slot.key == key))
+				continue;
+			return readValue(slot, value);
+		}
+	}
+
+	static ReadResult readValue(Slot& slot, V& value)
+	{
+		while(true)
+		{
+			const uint32_t version = slot.version.load(MEM_ACQUIRE);
+			if(unlikely((version & 1) != 0))
+				continue;
+			const uint32_t state = slot.state.load(MEM_RELAXED);
+			if(state & Moved)
+				return ReadResult::Moved;
+			if(state == Deleted)
+				return ReadResult::Absent;
+			memcpy(&value, &slot.value, sizeof(V));
+			std::atomic_thread_fence(MEM_ACQUIRE);
+			if(likely(slot.version.load(MEM_RELAXED) == version))
+				return ReadResult::Found;
+		}
+	}
+
+	/*
+	 * returns the table the write should go to , while a table is migrating the writer helps with one chunk and
+	 * makes sure the key itself was moved before writing it to the next table
+	 */
+	Table * prepareWrite(Table * table, const K& key)
+	{
+		for(Table * next = table->next.load(MEM_ACQUIRE); unlikely(next != nullptr); next = table->next.load(MEM_ACQUIRE))
+		{
+			helpMigrate(table);
+			migrateKey(table, key);
+			table = next;
+		}
+		return table;
+	}
+
+	WriteResult assign(Table * table, const K& key, const V& value, const bool only_if_absent)
+	{
+		for(size_t index = hashKey(key) & table->mask; ; )
+		{
+			Slot& slot = table->slots[index];
+			const uint32_t state = slot.state.load(MEM_ACQUIRE);
+			if(unlikely(state & Moved))
+				return WriteResult::Retry;
+			if(state != Empty && !(slot.key == key))
+			{
+				index = (index + 1) & table->mask;
+				continue;
+			}
+			if(state == Empty && !reserveSlot(table))
+			{
+				startMigration(table);
+				return WriteResult::Retry;
+			}
+			const uint32_t version = lockSlot(slot);
+			const uint32_t locked_state = slot.state.load(MEM_RELAXED);
+			if(state == Empty && locked_state != Empty)
+			{
+				//lost the slot to another writer , look at it again without advancing
+				unlockSlot(slot, version);
+				table->used.fetch_sub(1, MEM_RELAXED);
+				continue;
+			}
+			if(unlikely(locked_state & Moved))
+			{
+				unlockSlot(slot, version);
+				return WriteResult::Retry;
+			}
+			WriteResult result = WriteResult::Inserted;
+			if(locked_state == Full)
+			{
+				result = only_if_absent ? WriteResult::Present : WriteResult::Updated;
+				if(!only_if_absent)
+					memcpy(&slot.value, &value, sizeof(V));
+			}
+			else
+			{
+				if(locked_state == Empty)
+					memcpy(&slot.key, &key, sizeof(K));
+				memcpy(&slot.value, &value, sizeof(V));
+				slot.state.store(Full, MEM_RELEASE);
+			}
+			unlockSlot(slot, version);
+			return result;
+		}
+	}
+
+	WriteResult remove(Table * table, const K& key)
+	{
+		for(size_t index = hashKey(key) & table->mask; ; index = (index + 1) & table->mask)
+		{
+			Slot& slot = table->slots[index];
+			const uint32_t state = slot.state.load(MEM_ACQUIRE);
+			if(unlikely(state & Moved))
+				return WriteResult::Retry;
+			if(state == Empty)
+				return WriteResult::Absent;
+			if(!(slot.key == key))
+				continue;
+			const uint32_t version = lockSlot(slot);
+			const uint32_t locked_state = slot.state.load(MEM_RELAXED);
+			WriteResult result = WriteResult::Absent;
+			if(unlikely(locked_state & Moved))
+				result = WriteResult::Retry;
+			else if(locked_state == Full)
+			{
+				slot.state.store(Deleted, MEM_RELEASE);
+				result = WriteResult::Erased;
+			}
+			unlockSlot(slot, version);
+			return result;
+		}
+	}
+
+	//deleted slots keep their key so a slot is never reused for another key , resizing drops them
+	bool reserveSlot(Table * table)
+	{
+		if(likely(table->used.fetch_add(1, MEM_RELAXED) < table->max_used))
+			return true;
+		table->used.fetch_sub(1, MEM_RELAXED);
+		return false;
+	}
+
+	void startMigration(Table * table)
+	{
+		if(table->next.load(MEM_ACQUIRE) != nullptr)
+			return;
+		const size_t new_capacity = elements_count.load(MEM_RELAXED) > table->capacity / 4 ?
+				table->capacity * 2 : table->capacity;
+		Table * expected = nullptr;
+		Table * new_table = new Table(new_capacity);
+		if(!table->next.compare_exchange_strong(expected, new_table, MEM_RELEASE, MEM_ACQUIRE))
+			delete new_table;
+	}
+
+	void helpMigrate(Table * table)
+	{
+		const size_t start = table->migrate_position.fetch_add(migration_chunk, MEM_RELAXED);
+		if(start >= table->capacity)
+			return;
+		const size_t end = std::min(start + migration_chunk, table->capacity);
+		for(size_t i = start; i < end; ++i)
+			migrateSlot(table, table->slots[i]);
+		if(table->migrated.fetch_add(end - start, MEM_ACQ_REL) + (end - start) == table->capacity)
+			advanceCurrentTable();
+	}
+
+	//moves the slot holding key , or marks the empty slot ending its probe sequence so no writer can insert it late
+	void migrateKey(Table * table, const K& key)
+	{
+		for(size_t index = hashKey(key) & table->mask; ; )
+		{
+			Slot& slot = table->slots[index];
+			const uint32_t state = slot.state.load(MEM_ACQUIRE);
+			if(state & Moved)
+			{
+				if(state == (Moved | Empty) || slot.key == key)
+					return;
+				index = (index + 1) & table->mask;
+			}
+			else if(state != Empty && !(slot.key == key))
+				index = (index + 1) & table->mask;
+			else
+				migrateSlot(table, slot);
+		}
+	}
+
+	/*
+	 * the slot stays locked only while its own value is copied forward , when the next tables are migrating too
+	 * the key is moved through them alone and their chunks are helped after the slot was released
+	 */
+	void migrateSlot(Table * table, Slot& slot)
+	{
+		const uint32_t version = lockSlot(slot);
+		const uint32_t state = slot.state.load(MEM_RELAXED);
+		Table * next = table->next.load(MEM_ACQUIRE);
+		bool forwarded = false;
+		if(!(state & Moved))
+		{
+			if(state == Full)
+			{
+				while(true)
+				{
+					next = forwardKey(next, slot.key, forwarded);
+					if(likely(assign(next, slot.key, slot.value, true) != WriteResult::Retry))
+						break;
+				}
+			}
+			slot.state.store(state | Moved, MEM_RELEASE);
+		}
+		unlockSlot(slot, version);
+		if(unlikely(forwarded))
+			helpNextTables(table);
+	}
+
+	void helpNextTables(Table * table)
+	{
+		table = table->next.load(MEM_ACQUIRE);
+		for(Table * next = table->next.load(MEM_ACQUIRE); next != nullptr; next = table->next.load(MEM_ACQUIRE))
+		{
+			helpMigrate(table);
+			table = next;
+		}
+	}
+
+	//like prepareWrite without helping the chunks , forwarded is set when key had to pass a migrating table
+	Table * forwardKey(Table * table, const K& key, bool& forwarded)
+	{
+		for(Table * next = table->next.load(MEM_ACQUIRE); unlikely(next != nullptr); next = table->next.load(MEM_ACQUIRE))
+		{
+			migrateKey(table, key);
+			forwarded = true;
+			table = next;
+		}
+		return table;
+	}
+
+	void advanceCurrentTable()
+	{
+		Table * table = current_table.load(MEM_ACQUIRE);
+		while(table->migrated.load(MEM_ACQUIRE) == table->capacity)
+		{
+			Table * next = table->next.load(MEM_ACQUIRE);
+			if(current_table.compare_exchange_strong(table, next, MEM_ACQ_REL, MEM_ACQUIRE))
+			{
+				retireTable(table);
+				table = next;
+			}
+		}
+	}
+
+	//the slots are counted so replaced tables are collected long before 64 of them were retired
+	void retireTable(Table * table)
+	{
+		epoch_domain.retire(table, sizeof(Table) + sizeof(Slot) * table->capacity);
+	}
+
+	std::atomic<Table *> current_table;
+	char padding1[padding_size]; /* force current_table and elements_count to different cache lines */
+	std::atomic<size_t> elements_count;
+	mutable EpochDomain epoch_domain;
+};
+
+#endif
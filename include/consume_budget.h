@@ -0,0 +1,28 @@
+#ifndef CONSUMEBUDGET_H_
+#define CONSUMEBUDGET_H_
+
+#include <chrono>
+#include <cstddef>
+
+#define CONSUME_BUDGET_CHUNK 64
+
+/*
+ * drains queue with consumeUpTo chunks until it is empty or budget passed and returns the number of consumed
+ * elements , the clock is read once per chunk so the budget can be overrun by up to one chunk
+ */
+template <typename Queue, typename Functor>
+std::size_t consumeWithBudget(Queue& queue, const std::chrono::nanoseconds budget, const Functor& function)
+{
+	const auto deadline = std::chrono::steady_clock::now() + budget;
+	std::size_t consumed = 0;
+	std::size_t chunk;
+	do
+	{
+		chunk = queue.consumeUpTo(CONSUME_BUDGET_CHUNK, function);
+		consumed += chunk;
+	}
+	while(chunk == CONSUME_BUDGET_CHUNK && std::chrono::steady_clock::now() < deadline);
+	return consumed;
+}
+
+#endif
@@ -1,91 +1,277 @@
 #ifndef SPSCbuffer_H_
 #define SPSCbuffer_H_
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <boost/lockfree/detail/branch_hints.hpp>
 #include <cstring>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+#include "consume_budget.h"
 #include "queue_exceptions.h"
 
 #define MEM_RELAXED std::memory_order_relaxed
 #define MEM_ACQUIRE std::memory_order_acquire
 #define MEM_RELEASE std::memory_order_release
+#define MEM_ACQ_REL std::memory_order_acq_rel
 #define CACHE_LINE_SIZE 64
+#define INLINE_SLOT_MAX_SIZE CACHE_LINE_SIZE
 
 using boost::lockfree::detail::unlikely;
 using boost::lockfree::detail::likely;
 using size_t = std::size_t;
 
+/*
+ * slots are stored inline for small trivially copyable types , elements are constructed straight into the ring and
+ * growing the ring is a plain memcpy of the elements
+ */
+template <class T>
+class InlineSlotStorage
+{
+public:
+
+	InlineSlotStorage(const size_t size)
+	: slots(allocate(size))
+	{
+	}
+
+	InlineSlotStorage(InlineSlotStorage<T>&) = delete;
+
+	//copies the elements of storage starting at start , so start becomes the first slot
+	InlineSlotStorage(InlineSlotStorage<T>& storage, const size_t storage_size, const size_t start, const size_t size)
+	: slots(allocate(size))
+	{
+		const size_t read_size = storage_size - start;
+		memcpy(slots, &storage.slots[start], sizeof(T) * read_size);
+		memcpy(&slots[read_size], storage.slots, sizeof(T) * start);
+	}
+
+	T& operator[](const size_t index) const
+	{
+		return slots[index];
+	}
+
+	T * data() const
+	{
+		return slots;
+	}
+
+	template <typename... Args>
+	void construct(const size_t index, Args&&... args)
+	{
+		new (&slots[index]) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(const size_t)
+	{
+	}
+
+	bool released() const
+	{
+		return slots == nullptr;
+	}
+
+	void release()
+	{
+		::operator delete(slots, std::align_val_t(alignof(T)));
+		slots = nullptr;
+	}
+
+private:
+
+	static T * allocate(const size_t size)
+	{
+		return static_cast<T *>(::operator new(sizeof(T) * size, std::align_val_t(alignof(T))));
+	}
+
+	T * slots;
+};
+
+/*
+ * slots hold handles into pool blocks for large or non trivially copyable types , elements are constructed in place
+ * in the pool and growing the ring only copies the handles , the newest storage owns every block of the pool
+ */
+template <class T>
+class HandleSlotStorage
+{
+public:
+
+	HandleSlotStorage(const size_t size)
+	: slots(new T*[size])
+	{
+		T * block = allocateBlock(size);
+		for(size_t i = 0; i < size; ++i)
+			slots[i] = &block[i];
+	}
+
+	HandleSlotStorage(HandleSlotStorage<T>&) = delete;
+
+	//copies the handles of storage starting at start and takes over its pool blocks
+	HandleSlotStorage(HandleSlotStorage<T>& storage, const size_t storage_size, const size_t start, const size_t size)
+	: slots(new T*[size])
+	, blocks(std::move(storage.blocks))
+	{
+		const size_t read_size = storage_size - start;
+		memcpy(slots, &storage.slots[start], sizeof(T*) * read_size);
+		memcpy(&slots[read_size], storage.slots, sizeof(T*) * start);
+		T * block = allocateBlock(size - storage_size);
+		for(size_t i = storage_size; i < size; ++i)
+			slots[i] = &block[i - storage_size];
+	}
+
+	T& operator[](const size_t index) const
+	{
+		return *slots[index];
+	}
+
+	template <typename... Args>
+	void construct(const size_t index, Args&&... args)
+	{
+		new (slots[index]) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(const size_t index)
+	{
+		slots[index]->~T();
+	}
+
+	bool released() const
+	{
+		return slots == nullptr;
+	}
+
+	void release()
+	{
+		delete [] slots;
+		slots = nullptr;
+		for(T * block : blocks)
+			::operator delete(block, std::align_val_t(alignof(T)));
+		blocks.clear();
+	}
+
+private:
+
+	T * allocateBlock(const size_t size)
+	{
+		T * block = static_cast<T *>(::operator new(sizeof(T) * size, std::align_val_t(alignof(T))));
+		blocks.push_back(block);
+		return block;
+	}
+
+	T ** slots;
+	std::vector<T *> blocks;
+};
+
+template <class T>
+struct IsInlineSlot
+{
+	static const bool value = std::is_trivially_copyable<T>::value && sizeof(T) <= INLINE_SLOT_MAX_SIZE;
+};
+
+template <class T>
+using SlotStorage = typename std::conditional<IsInlineSlot<T>::value, InlineSlotStorage<T>, HandleSlotStorage<T>>::type;
+
+/*
+ * how often the producer publishes writer_position and the consumer publishes reader_position
+ * the producer publishes every publish_batch pushes , when a push fails or on flush , when max_publish_delay is set
+ * a push also publishes once the oldest staged element waited longer than it (this costs a clock read per push) , a
+ * producer that runs out of elements to push calls tick so the staged ones still go out after max_publish_delay
+ * the consumer of consumeOne , pop , tryPop and popOnSuccses releases every release_batch elements , when the buffer
+ * looks empty or on releaseReads , consumeAll and consumeSpan always release what they consumed
+ */
+struct PublishPolicy
+{
+	PublishPolicy(const size_t _publish_batch = 1, const size_t _release_batch = 1,
+			const std::chrono::nanoseconds _max_publish_delay = std::chrono::nanoseconds::zero())
+	: publish_batch(_publish_batch)
+	, release_batch(_release_batch)
+	, max_publish_delay(_max_publish_delay)
+	{
+	}
+
+	size_t publish_batch;
+	size_t release_batch;
+	std::chrono::nanoseconds max_publish_delay;
+};
+
 template <class T>
 class CyclicBuffer
 {
 public:
 
-	CyclicBuffer(const std::size_t _buffer_size)
-	: writer_position(0)
-	, reader_position(0)
+	CyclicBuffer(const std::size_t _buffer_size, const PublishPolicy& _policy = PublishPolicy())
+	: buffer(_buffer_size)
 	, buffer_size(_buffer_size)
+	, policy(_policy)
+	, reader_position(0)
+	, local_reader_position(0)
+	, unreleased_count(0)
+	, writer_position(0)
+	, local_writer_position(0)
+	, unpublished_count(0)
 	{
-		initalizeBuffer();
 	}
 
 	CyclicBuffer(CyclicBuffer<T>&) = delete;
 	CyclicBuffer(CyclicBuffer<T>&&) = default;
 
-	CyclicBuffer(const CyclicBuffer<T>& _buffer, const size_t _buffer_size)
-	: writer_position(_buffer.buffer_size - 1)
-	, reader_position(0)
+	/*
+	 * should be only used by the producer when _buffer is full , the elements are copied starting right after the
+	 * producer position so the copy does not depend on how far the consumer got meanwhile
+	 */
+	CyclicBuffer(CyclicBuffer<T>& _buffer, const size_t _buffer_size)
+	: buffer(_buffer.buffer, _buffer.buffer_size,
+			calculateNextPosition(_buffer.local_writer_position, _buffer.buffer_size), _buffer_size)
 	, buffer_size(_buffer_size)
+	, policy(_buffer.policy)
+	, reader_position(0)
+	, local_reader_position(0)
+	, unreleased_count(0)
+	, writer_position(_buffer.buffer_size - 1)
+	, local_writer_position(_buffer.buffer_size - 1)
+	, unpublished_count(0)
 	{
-		buffer = new T*[buffer_size];
-		const size_t reader_pos = _buffer.reader_position.load(MEM_ACQUIRE);
-		const size_t read_size = _buffer.buffer_size - reader_pos;
-		if(reader_pos != 0)
-		{
-			memcpy(buffer, &_buffer.buffer[reader_pos], sizeof(T*) * (read_size));
-			memcpy(&buffer[read_size], _buffer.buffer, sizeof(T*) * (reader_pos));
-		}
-		else
-			memcpy(buffer, _buffer.buffer, sizeof(T*) * _buffer.buffer_size);
-		for(int i = _buffer.buffer_size; i < buffer_size; ++i)
-			buffer[i] = new T();
 	}
 
 	~CyclicBuffer()
 	{
-		if(buffer != nullptr)
+		if(!buffer.released())
 		{
-			for (int i = 0; i < buffer_size; ++i)
-				delete buffer[i];
+			for(size_t i = local_reader_position; i != local_writer_position; i = calculateNextPosition(i, buffer_size))
+				buffer.destroy(i);
 			deleteBuffer();
 		}
 	}
 
 	bool push(const T& element)
 	{
-		const size_t current_position = writer_position.load(MEM_RELAXED);
-		const size_t next_pos = calculateNextPosition(current_position, buffer_size);
+		const size_t current_position = local_writer_position;
 		if(!canWrite(current_position))
-			return false;
-		new (buffer[current_position]) T(element);
-		writer_position.store(next_pos, MEM_RELEASE);
+			return failPush();
+		buffer.construct(current_position, element);
+		increaseWriterPos(current_position);
 		return true;
 	}
 
 	bool push(T&& element)
 	{
-		const size_t current_position = writer_position.load(MEM_RELAXED);
-		const size_t next_pos = calculateNextPosition(current_position, buffer_size);
+		const size_t current_position = local_writer_position;
 		if(!canWrite(current_position))
-			return false;
-		new (buffer[current_position]) T(element);
-		writer_position.store(next_pos, MEM_RELEASE);
+			return failPush();
+		buffer.construct(current_position, std::move(element));
+		increaseWriterPos(current_position);
 		return true;
 	}
 
 	bool pop()
 	{
-		return consumeOne([]{});
+		return consumeOne([](T&&){});
 	}
 
 	bool tryPop(T& element)
@@ -107,49 +293,137 @@ public:
 	template <typename Functor>
 	bool popOnSuccses(const Functor& function)
 	{
-		const size_t current_position = reader_position.load(MEM_RELAXED);
-		bool result = function(*buffer[current_position]);
-		const size_t next_pos = calculateNextPosition(current_position, buffer_size);
-		if(!canRead(current_position) | !result)
+		const size_t current_position = local_reader_position;
+		if(!canRead(current_position))
+			return failRead();
+		if(!function(buffer[current_position]))
 			return false;
-		increaseReaderPos(current_position, next_pos);
+		increaseReaderPos(current_position);
 		return true;
 	}
 
 	template <typename Functor>
 	bool consumeOne(const Functor& function)
 	{
-		const size_t current_position = reader_position.load(MEM_RELAXED);
-		const size_t next_pos = calculateNextPosition(current_position, buffer_size);
+		const size_t current_position = local_reader_position;
 		if(!canRead(current_position))
-			return false;
-		function(std::move(*buffer[current_position]));
-		increaseReaderPos(current_position, next_pos);
+			return failRead();
+		function(std::move(buffer[current_position]));
+		increaseReaderPos(current_position);
 		return true;
 	}
 	
+	//consumes until the buffer is empty , returns the number of consumed elements
 	template <typename Functor>
-	void consumeAll(const Functor& function)
+	size_t consumeAll(const Functor& function)
 	{
-		size_t current_pos = reader_position.load(MEM_RELAXED);
+		size_t current_pos = local_reader_position;
+		size_t consumed = 0;
 		for(size_t current_size = availableRead(current_pos); current_size > 0;
 				current_size = availableRead(current_pos))
 		{
 			current_pos = consumeSize(function, current_pos, current_size);
-			reader_position.store(current_pos, MEM_RELEASE);
+			consumed += current_size;
+			releaseReads(current_pos);
+		}
+		releaseReads();
+		return consumed;
+	}
+
+	/*
+	 * like consumeAll but stops after max elements , so a consumer that serves several queues is not held by a fast
+	 * producer on one of them , returns the number of consumed elements
+	 */
+	template <typename Functor>
+	size_t consumeUpTo(const size_t max, const Functor& function)
+	{
+		size_t current_pos = local_reader_position;
+		size_t consumed = 0;
+		for(size_t current_size = std::min(availableRead(current_pos), max); current_size > 0;
+				current_size = std::min(availableRead(current_pos), max - consumed))
+		{
+			current_pos = consumeSize(function, current_pos, current_size);
+			consumed += current_size;
+			releaseReads(current_pos);
 		}
+		releaseReads();
+		return consumed;
+	}
+
+	//consumes until the buffer is empty or budget passed , returns the number of consumed elements
+	template <typename Functor>
+	size_t consumeFor(const std::chrono::nanoseconds budget, const Functor& function)
+	{
+		return consumeWithBudget(*this, budget, function);
 	}
 	
+#if __cplusplus >= 202002L
+	/*
+	 * only for inline slots , hands the readable elements to function as at most two contiguous spans over the ring
+	 * memory and releases them all at once without calling destructors , returns the number of consumed elements
+	 */
+	template <typename Functor>
+	size_t consumeSpan(const Functor& function)
+	{
+		static_assert(IsInlineSlot<T>::value, "consumeSpan needs a trivially copyable T stored inline");
+		const size_t current_pos = local_reader_position;
+		const size_t consumed_size = availableRead(current_pos);
+		if(consumed_size == 0)
+		{
+			releaseReads();
+			return 0;
+		}
+		const size_t end_index = current_pos + consumed_size;
+		if(end_index > buffer_size)
+		{
+			function(std::span<const T>(buffer.data() + current_pos, buffer_size - current_pos));
+			function(std::span<const T>(buffer.data(), end_index - buffer_size));
+			releaseReads(end_index - buffer_size);
+		}
+		else
+		{
+			function(std::span<const T>(buffer.data() + current_pos, consumed_size));
+			releaseReads(end_index == buffer_size ? 0 : end_index);
+		}
+		return consumed_size;
+	}
+#endif
+
+	//should be only used by the producer , publishes every staged element to the consumer
+	void flush()
+	{
+		if(unpublished_count != 0)
+		{
+			unpublished_count = 0;
+			writer_position.store(local_writer_position, MEM_RELEASE);
+		}
+	}
+
+	//should be only used by the producer , publishes the staged elements once the oldest waited max_publish_delay
+	void tick()
+	{
+		if(unpublished_count != 0 && policy.max_publish_delay != std::chrono::nanoseconds::zero() &&
+				std::chrono::steady_clock::now() - first_unpublished_time >= policy.max_publish_delay)
+			flush();
+	}
+
+	//should be only used by the consumer , gives every consumed slot back to the producer
+	void releaseReads()
+	{
+		if(unreleased_count != 0)
+			releaseReads(local_reader_position);
+	}
+
 	//should be only used by the consumer , returns true when the queue isnt empty otherwise false
 	bool canRead() const
 	{
-		return canRead(reader_position.load(MEM_RELAXED));
+		return canRead(local_reader_position);
 	}
 
 	//should be only used by the producer , returns true when the queue isnt full otherwise false
 	bool canWrite() const
 	{
-		return canWrite(writer_position.load(MEM_RELAXED));
+		return canWrite(local_writer_position);
 	}
 	
 	
@@ -158,40 +432,33 @@ public:
 	 */
 	void unSafePush(const T& element)
 	{
-		const size_t current_position = writer_position.load(MEM_RELAXED);
-		const size_t next_position = calculateNextPosition(current_position, buffer_size);
-		new (buffer[current_position]) T(element);
-		writer_position.store(next_position, MEM_RELEASE);
+		const size_t current_position = local_writer_position;
+		buffer.construct(current_position, element);
+		increaseWriterPos(current_position);
 	}
 	
 	void unSafePush(T&& element)
 	{
-		const size_t current_position = writer_position.load(MEM_RELAXED);
-		const size_t next_position = calculateNextPosition(current_position, buffer_size);
-		new (buffer[current_position]) T(element);
-		writer_position.store(next_position, MEM_RELEASE);
+		const size_t current_position = local_writer_position;
+		buffer.construct(current_position, std::move(element));
+		increaseWriterPos(current_position);
 	}
 	
+	//the producer must flush _buffer before it grows , so its published writer_position is where the copy ends
 	void syncReader(const CyclicBuffer<T>& _buffer)
 	{
-		reader_position.store((_buffer.buffer_size - 1) - 
-				_buffer.availableRead(_buffer.reader_position.load(MEM_RELAXED)), MEM_RELEASE);
+		local_reader_position = (_buffer.buffer_size - 1) - _buffer.availableRead(_buffer.local_reader_position);
+		releaseReads(local_reader_position);
 	}
 
-	void deleteBuffer() const
+	//frees the slots without destroying the elements , they were handed over to a bigger buffer
+	void deleteBuffer()
 	{
-		delete [] buffer;
+		buffer.release();
 	}
 
 private:
 
-	void initalizeBuffer()
-	{
-		buffer = new T*[buffer_size];
-		for (int i = 0; i < buffer_size; ++i)
-			buffer[i] = new T();
-	}
-
 	bool canRead(const size_t reader_pos) const
 	{
 		return likely(availableRead(reader_pos) > 0);
@@ -210,7 +477,7 @@ private:
 	}
 
 	template <typename Functor>
-	const size_t consumeSize(const Functor& function, const size_t current_pos, const size_t consumed_size) const
+	const size_t consumeSize(const Functor& function, const size_t current_pos, const size_t consumed_size)
 	{
 		const size_t end_index = current_pos + consumed_size;
 		if(end_index > buffer_size)
@@ -227,12 +494,12 @@ private:
 	}
 
 	template <typename Functor>
-	void consumeRange(const Functor& function, const size_t start_index, const size_t end_index) const
+	void consumeRange(const Functor& function, const size_t start_index, const size_t end_index)
 	{
-		for(int i = start_index; i < end_index; ++i)
+		for(size_t i = start_index; i < end_index; ++i)
 		{
-			function(std::move(*buffer[i]));
-			buffer[i]->~T();
+			function(std::move(buffer[i]));
+			buffer.destroy(i);
 		}
 	}
 
@@ -251,32 +518,76 @@ private:
 		return ret;
 	}
 
-	void increaseReaderPos(const size_t current_position, const size_t next_position)
+	void increaseWriterPos(const size_t current_position)
 	{
-		reader_position.store(next_position, MEM_RELEASE);
-		buffer[current_position]->~T();
+		local_writer_position = calculateNextPosition(current_position, buffer_size);
+		if(likely(++unpublished_count >= policy.publish_batch) || publishDelayExpired())
+			flush();
+	}
+
+	bool publishDelayExpired()
+	{
+		if(likely(policy.max_publish_delay == std::chrono::nanoseconds::zero()))
+			return false;
+		const auto now = std::chrono::steady_clock::now();
+		if(unpublished_count == 1)
+			first_unpublished_time = now;
+		return now - first_unpublished_time >= policy.max_publish_delay;
+	}
+
+	//a full buffer publishes the staged elements so the consumer can make room
+	bool failPush()
+	{
+		flush();
+		return false;
+	}
+
+	void increaseReaderPos(const size_t current_position)
+	{
+		buffer.destroy(current_position);
+		local_reader_position = calculateNextPosition(current_position, buffer_size);
+		if(likely(++unreleased_count >= policy.release_batch))
+			releaseReads(local_reader_position);
+	}
+
+	void releaseReads(const size_t reader_pos)
+	{
+		local_reader_position = reader_pos;
+		unreleased_count = 0;
+		reader_position.store(reader_pos, MEM_RELEASE);
+	}
+
+	//an empty buffer gives the consumed slots back so the producer can keep writing
+	bool failRead()
+	{
+		releaseReads();
+		return false;
 	}
 	
 	template <typename Functor>
 	bool push(const Functor& function)
 	{
-		const size_t current_position = writer_position.load(MEM_RELAXED);
-		const size_t next_pos = calculateNextPosition(current_position, buffer_size);
+		const size_t current_position = local_writer_position;
 		if(!canWrite(current_position))
-			return false;
-		new (buffer[current_position]) T(function());
-		writer_position.store(next_pos, MEM_RELEASE);
+			return failPush();
+		buffer.construct(current_position, function());
+		increaseWriterPos(current_position);
 		return true;
 	}
 
-	T** buffer;
-
-	static const int padding_size = CACHE_LINE_SIZE - sizeof(size_t);
+	SlotStorage<T> buffer;
+	const size_t buffer_size;
+	const PublishPolicy policy;
 
+	char padding1[CACHE_LINE_SIZE]; /* keep the fields both sides read away from the positions they write */
 	std::atomic<size_t> reader_position;
-	char padding1[padding_size]; /* force reader_position and writer_position to different cache lines */
+	size_t local_reader_position;
+	size_t unreleased_count;
+	char padding2[CACHE_LINE_SIZE]; /* force the consumer fields and the producer fields to different cache lines */
 	std::atomic<size_t> writer_position;
-	const size_t buffer_size;
+	size_t local_writer_position;
+	size_t unpublished_count;
+	std::chrono::steady_clock::time_point first_unpublished_time;
 
 };
 
@@ -0,0 +1,209 @@
+#ifndef FLIGHTRECORDER_H_
+#define FLIGHTRECORDER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "cyclic_buffer.h"
+
+/*
+ * lossy single producer ring for always on tracing , push never blocks and never fails , when the ring is full it
+ * overwrites the oldest entry
+ * every slot carries the sequence of the entry in it , odd while the producer writes it , so a reader that was
+ * lapped sees the sequence moved , skips to the oldest entry still in the ring and counts what it lost in dropped
+ * snapshot copies the last entries without touching the reader , it takes no lock and allocates nothing so it can
+ * run from a crash handler
+ * elements are copied out under the sequence like the values of ConcurrentHashMap so they must be trivially copyable
+ */
+template <class T>
+class FlightRecorder
+{
+	static_assert(std::is_trivially_copyable<T>::value, "FlightRecorder elements must be trivially copyable");
+
+public:
+
+	FlightRecorder(const size_t _capacity)
+	: capacity(roundCapacity(_capacity))
+	, mask(capacity - 1)
+	, slots(new Slot[capacity])
+	, read_position(0)
+	, dropped_count(0)
+	, writer_position(0)
+	, local_writer_position(0)
+	{
+	}
+
+	FlightRecorder(FlightRecorder&) = delete;
+
+	//should be only used by the producer
+	void push(const T& element)
+	{
+		const uint64_t position = local_writer_position;
+		Slot& slot = slots[position & mask];
+		slot.sequence.store(2 * position + 1, MEM_RELAXED);
+		std::atomic_thread_fence(MEM_RELEASE);
+		memcpy(&slot.value, &element, sizeof(T));
+		slot.sequence.store(2 * position + 2, MEM_RELEASE);
+		local_writer_position = position + 1;
+		writer_position.store(local_writer_position, MEM_RELEASE);
+	}
+
+	//should be only used by the reader , returns true when an element was handed to function otherwise false
+	template <typename Functor>
+	bool consumeOne(const Functor& function)
+	{
+		T element;
+		if(!readNext(writer_position.load(MEM_ACQUIRE), element))
+			return false;
+		function(std::move(element));
+		return true;
+	}
+
+	bool tryPop(T& element)
+	{
+		return readNext(writer_position.load(MEM_ACQUIRE), element);
+	}
+
+	//returns the number of elements handed to function , the ones lost to overruns are added to dropped
+	template <typename Functor>
+	size_t consumeAll(const Functor& function)
+	{
+		const uint64_t end = writer_position.load(MEM_ACQUIRE);
+		size_t consumed = 0;
+		T element;
+		while(readNext(end, element))
+		{
+			function(std::move(element));
+			++consumed;
+		}
+		return consumed;
+	}
+
+	//like consumeAll but stops after max elements
+	template <typename Functor>
+	size_t consumeUpTo(const size_t max, const Functor& function)
+	{
+		const uint64_t end = writer_position.load(MEM_ACQUIRE);
+		size_t consumed = 0;
+		T element;
+		while(consumed < max && readNext(end, element))
+		{
+			function(std::move(element));
+			++consumed;
+		}
+		return consumed;
+	}
+
+	template <typename Functor>
+	size_t consumeFor(const std::chrono::nanoseconds budget, const Functor& function)
+	{
+		return consumeWithBudget(*this, budget, function);
+	}
+
+	//entries the reader lost because the producer overwrote them first
+	const uint64_t dropped() const
+	{
+		return dropped_count;
+	}
+
+	/*
+	 * copies up to count of the newest entries to out , oldest first , returns how many were copied
+	 * can be used from any thread while the producer and the reader keep running , entries overwritten during the
+	 * copy are left out
+	 */
+	size_t snapshot(T * out, const size_t count) const
+	{
+		const uint64_t end = writer_position.load(MEM_ACQUIRE);
+		const uint64_t first = end - std::min<uint64_t>(std::min<uint64_t>(count, capacity), end);
+		size_t copied = 0;
+		for(uint64_t position = first; position < end; ++position)
+			if(readSlot(position, out[copied]))
+				++copied;
+		return copied;
+	}
+
+	std::vector<T> snapshot(const size_t count) const
+	{
+		std::vector<T> entries(std::min<size_t>(count, capacity));
+		entries.resize(snapshot(entries.data(), entries.size()));
+		return entries;
+	}
+
+	//entries pushed since the recorder was created
+	const uint64_t written() const
+	{
+		return writer_position.load(MEM_ACQUIRE);
+	}
+
+	const size_t size() const
+	{
+		return capacity;
+	}
+
+private:
+
+	struct Slot
+	{
+		Slot()
+		: sequence(0)
+		{
+		}
+
+		std::atomic<uint64_t> sequence; /* 2 * position + 1 while the entry is written , 2 * position + 2 after */
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+	};
+
+	static const size_t roundCapacity(const size_t capacity)
+	{
+		size_t ret = 2;
+		while(ret < capacity)
+			ret *= 2;
+		return ret;
+	}
+
+	//returns false when the entry of position was already overwritten
+	bool readSlot(const uint64_t position, T& element) const
+	{
+		const Slot& slot = slots[position & mask];
+		const uint64_t sequence = slot.sequence.load(MEM_ACQUIRE);
+		if(sequence != 2 * position + 2)
+			return false;
+		memcpy(&element, &slot.value, sizeof(T));
+		std::atomic_thread_fence(MEM_ACQUIRE);
+		return slot.sequence.load(MEM_RELAXED) == sequence;
+	}
+
+	bool readNext(const uint64_t end, T& element)
+	{
+		while(read_position < end)
+		{
+			if(likely(readSlot(read_position, element)))
+			{
+				++read_position;
+				return true;
+			}
+			//lapped , the producer is at least a whole ring ahead so jump to the oldest entry it did not reach yet
+			const uint64_t oldest = writer_position.load(MEM_ACQUIRE) - capacity;
+			const uint64_t next = std::max(read_position + 1, oldest);
+			dropped_count += next - read_position;
+			read_position = next;
+		}
+		return false;
+	}
+
+	const size_t capacity;
+	const size_t mask;
+	std::unique_ptr<Slot[]> slots;
+	uint64_t read_position;
+	uint64_t dropped_count;
+	char padding1[CACHE_LINE_SIZE]; /* force the reader fields and the producer fields to different cache lines */
+	std::atomic<uint64_t> writer_position;
+	uint64_t local_writer_position;
+};
+
+#endif
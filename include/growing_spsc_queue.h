@@ -2,40 +2,69 @@
 #define GROWINGSPSCQUEUE_H_
 
 #include "cyclic_buffer.h"
+#include "spill_store.h"
 
 #define DEFAULT_QUEUE_SIZE 1024
 
-template <class T>
+template <class T, class Serializer = SpillSerializer<T>>
 class GrowingSpscQueue
 {
 public:
-	GrowingSpscQueue()
+	GrowingSpscQueue(const PublishPolicy& policy = PublishPolicy())
 	: allocatedBlocks(1)
+	, spill_store(nullptr)
+	, max_memory_capacity(0)
+	, spilling(false)
 	{
-		initalizeQueue();
+		initalizeQueue(policy);
 	}
 
-	GrowingSpscQueue(GrowingSpscQueue<T>&) = delete;
-	GrowingSpscQueue(GrowingSpscQueue<T>&&) = default;
+	/*
+	 * overflow mode , once the ring holds spill_config.max_memory_capacity elements it stops growing and pushes are
+	 * appended to memory mapped segment files , the consumer replays them in order after the elements in memory
+	 */
+	GrowingSpscQueue(const SpillConfig& spill_config, const PublishPolicy& policy = PublishPolicy())
+	: allocatedBlocks(1)
+	, spill_store(new SpillStore<T, Serializer>(spill_config))
+	, max_memory_capacity(spill_config.max_memory_capacity)
+	, spilling(false)
+	{
+		static_assert(Serializer::enabled, "spilling needs a trivially copyable T or a user serializer");
+		initalizeQueue(policy);
+	}
+
+	GrowingSpscQueue(GrowingSpscQueue&) = delete;
+	GrowingSpscQueue(GrowingSpscQueue&&) = default;
 
 	~GrowingSpscQueue()
 	{
-		delete writer_queue;
-		if(reader_queue != writer_queue)
-			delete reader_queue;
+		syncReaderQueue();
+		delete reader_queue;
+		delete spill_store;
 	}
 
 	/*
 	 * push function cannot fail , they can only throw exception when there is no more memory to allocate
+	 * or when a spill segment cannot be created
 	 */
 	void push(const T& element)
 	{
+		if(unlikely(spill_store != nullptr) && shouldSpill())
+		{
+			spill_store->append(element);
+			return;
+		}
 		allocateSizeIfNeeded();
 		writer_queue->unSafePush(element);
 	}
 	
 	void push(T&& element)
 	{
+		if(unlikely(spill_store != nullptr) && shouldSpill())
+		{
+			spill_store->append(element);
+			return;
+		}
 		allocateSizeIfNeeded();
 		writer_queue->unSafePush(std::move(element));
 	}
@@ -43,7 +72,9 @@ public:
 	bool pop()
 	{
 		syncReaderQueue();
-		return reader_queue->pop();
+		if(reader_queue->pop())
+			return true;
+		return spilledReady() && (reader_queue->pop() || spill_store->consumeOne([](T&&){}));
 	}
 	
 	/*
@@ -53,34 +84,128 @@ public:
 	bool tryPop(T& element)
 	{
 		syncReaderQueue();
-		return reader_queue->tryPop(element);
+		if(reader_queue->tryPop(element))
+			return true;
+		return spilledReady() && (reader_queue->tryPop(element) || spill_store->consumeOne([&element](T&& current){
+			element = std::move(current);
+		}));
 	}
 	
 	//this function will not throw but it can fail and will reutnr nullptr if so , otherwise unique_ptr with the value
 	std::unique_ptr<T> tryPop()
 	{
 		syncReaderQueue();
-		return reader_queue->tryPop();
+		std::unique_ptr<T> element = reader_queue->tryPop();
+		if(element != nullptr || !spilledReady())
+			return element;
+		element = reader_queue->tryPop();
+		if(element == nullptr)
+			spill_store->consumeOne([&element](T&& current){
+				element.reset(new T(std::move(current)));
+			});
+		return element;
 	}
 
 	template<typename Functor>
 	bool popOnSuccses(const Functor& function)
 	{
 		syncReaderQueue();
-		return reader_queue->popOnSuccses(function);
+		//a rejected element in memory must not let the consumer skip ahead to the disk
+		if(reader_queue->canRead() || !spilledReady() || reader_queue->canRead())
+			return reader_queue->popOnSuccses(function);
+		return spill_store->popOnSuccses(function);
+	}
+
+	template<typename Functor>
+	size_t consumeAll(const Functor& function)
+	{
+		syncReaderQueue();
+		size_t consumed = reader_queue->consumeAll(function);
+		while(spilledReady())
+		{
+			if(reader_queue->canRead())
+				consumed += reader_queue->consumeAll(function);
+			else if(spill_store->consumeOne(function))
+				++consumed;
+		}
+		return consumed;
+	}
+
+	//the disk is read only while the ring in memory is empty , like consumeAll
+	template<typename Functor>
+	size_t consumeUpTo(const size_t max, const Functor& function)
+	{
+		syncReaderQueue();
+		size_t consumed = reader_queue->consumeUpTo(max, function);
+		while(consumed < max && spilledReady())
+		{
+			if(reader_queue->canRead())
+				consumed += reader_queue->consumeUpTo(max - consumed, function);
+			else if(spill_store->consumeOne(function))
+				++consumed;
+		}
+		return consumed;
 	}
 
 	template<typename Functor>
-	void consumeAll(const Functor& function)
+	size_t consumeFor(const std::chrono::nanoseconds budget, const Functor& function)
+	{
+		return consumeWithBudget(*this, budget, function);
+	}
+
+#if __cplusplus >= 202002L
+	template<typename Functor>
+	size_t consumeSpan(const Functor& function)
 	{
 		syncReaderQueue();
-		reader_queue->consumeAll(function);
+		size_t consumed = reader_queue->consumeSpan(function);
+		T batch[spill_batch_size];
+		while(spilledReady())
+		{
+			if(reader_queue->canRead())
+			{
+				consumed += reader_queue->consumeSpan(function);
+				continue;
+			}
+			size_t batch_size = 0;
+			while(batch_size < spill_batch_size && spilledNext() && spill_store->consumeOne([&](T&& element) {
+				batch[batch_size++] = element;
+			}));
+			if(batch_size != 0)
+				function(std::span<const T>(batch, batch_size));
+			consumed += batch_size;
+		}
+		return consumed;
+	}
+#endif
+
+	//should be only used by the producer , publishes every staged element to the consumer
+	void flush()
+	{
+		writer_queue->flush();
+		leaveSpillIfDrained();
+	}
+
+	/*
+	 * should be only used by the producer , publishes the staged elements once the oldest waited max_publish_delay
+	 * and gives the spill segment back once the consumer read all of it
+	 */
+	void tick()
+	{
+		writer_queue->tick();
+		leaveSpillIfDrained();
+	}
+
+	//should be only used by the consumer , gives every consumed slot back to the producer
+	void releaseReads()
+	{
+		reader_queue->releaseReads();
 	}
 
 	//should be only used by the consumer , returns true when the queue isnt empty otherwise false
 	bool canRead() const
 	{
-		return reader_queue->canRead();
+		return reader_queue->canRead() || (spill_store != nullptr && spill_store->canRead());
 	}
 
 	//should be only used by the producer , returns true when the queue isnt full otherwise false
@@ -96,9 +221,9 @@ public:
 
 private:
 
-	void initalizeQueue()
+	void initalizeQueue(const PublishPolicy& policy)
 	{
-		writer_queue = new CyclicBuffer<T>(DEFAULT_QUEUE_SIZE);
+		writer_queue = new CyclicBuffer<T>(DEFAULT_QUEUE_SIZE, policy);
 		reader_queue = writer_queue;
 		last_used_queue.store(nullptr, MEM_RELAXED);
 	}
@@ -106,9 +231,14 @@ private:
 	void allocateMoreSize()
 	{
 		allocatedBlocks *= 2;
+		writer_queue->flush();
 		auto * new_queue = new CyclicBuffer<T>(*(writer_queue), capacity());
-		if(last_used_queue.compare_exchange_strong(writer_queue, new_queue, MEM_RELEASE, MEM_RELAXED))
+		auto * old_queue = writer_queue;
+		if(last_used_queue.compare_exchange_strong(old_queue, new_queue, MEM_RELEASE, MEM_RELAXED))
+		{
 			writer_queue->deleteBuffer();
+			delete writer_queue;
+		}
 		else
 			last_used_queue.store(new_queue, MEM_RELEASE);
 		writer_queue = new_queue;
@@ -119,6 +249,7 @@ private:
 		while(!last_used_queue.compare_exchange_weak(queue, nullptr, MEM_ACQUIRE, MEM_RELAXED));
 		queue->syncReader(*reader_queue);
 		reader_queue->deleteBuffer();
+		delete reader_queue;
 		reader_queue = queue;
 	}
 	
@@ -140,6 +271,51 @@ private:
 			allocateMoreSize();
 	}
 
+	/*
+	 * once spilling started every push goes to disk until the consumer read all of it , otherwise newer elements
+	 * in memory would overtake the older ones on disk
+	 */
+	bool shouldSpill()
+	{
+		if(spilling && !leaveSpillIfDrained())
+			return true;
+		if(writer_queue->canWrite() || capacity() * 2 <= max_memory_capacity)
+			return false;
+		writer_queue->flush();
+		spilling = true;
+		return true;
+	}
+
+	//returns true when the producer is back in memory , the drained tail segment is sealed so the consumer unmaps it
+	bool leaveSpillIfDrained()
+	{
+		if(likely(!spilling))
+			return true;
+		if(!spill_store->drained())
+			return false;
+		spill_store->seal();
+		spilling = false;
+		return true;
+	}
+
+	/*
+	 * disk elements are newer than anything in memory , so the ring is synced again before they are read
+	 * the producer goes back to memory once the disk was drained and may fill the ring and spill again while the
+	 * consumer is still reading , so a disk element is read only while the synced ring is empty
+	 */
+	bool spilledReady()
+	{
+		if(likely(spill_store == nullptr) || !spill_store->canRead())
+			return false;
+		syncReaderQueue();
+		return true;
+	}
+
+	bool spilledNext()
+	{
+		return spilledReady() && !reader_queue->canRead();
+	}
+
 	static const int padding_size = CACHE_LINE_SIZE - sizeof(CyclicBuffer<T> *);
 
 	CyclicBuffer<T> * reader_queue;
@@ -147,6 +323,11 @@ private:
 	char padding1[padding_size]; /* force writer_queue and reader_queue to different cache lines */
 	CyclicBuffer<T> * writer_queue;
 	int allocatedBlocks;
+	SpillStore<T, Serializer> * spill_store;
+	size_t max_memory_capacity;
+	bool spilling;
+
+	static const size_t spill_batch_size = 64;
 };
 
 #endif
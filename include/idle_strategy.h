@@ -0,0 +1,72 @@
+#ifndef IDLESTRATEGY_H_
+#define IDLESTRATEGY_H_
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#define DEFAULT_IDLE_SPINS 128
+#define DEFAULT_IDLE_YIELDS 32
+#define DEFAULT_IDLE_MAX_SLEEP std::chrono::microseconds(1000)
+
+/*
+ * backoff for a thread polling queues , it spins first , then yields the core and then sleeps with a doubling
+ * sleep up to max_sleep , reset should be called as soon as the thread found work
+ */
+class AdaptiveIdleStrategy
+{
+public:
+
+	AdaptiveIdleStrategy(const int _spins = DEFAULT_IDLE_SPINS, const int _yields = DEFAULT_IDLE_YIELDS,
+			const std::chrono::microseconds _max_sleep = DEFAULT_IDLE_MAX_SLEEP)
+	: spins(_spins)
+	, yields(_yields)
+	, max_sleep(_max_sleep)
+	, idle_count(0)
+	, current_sleep(1)
+	{
+	}
+
+	void idle()
+	{
+		if(idle_count < spins)
+		{
+			++idle_count;
+			cpuRelax();
+		}
+		else if(idle_count < spins + yields)
+		{
+			++idle_count;
+			std::this_thread::yield();
+		}
+		else
+		{
+			std::this_thread::sleep_for(current_sleep);
+			current_sleep = std::min(current_sleep * 2, max_sleep);
+		}
+	}
+
+	void reset()
+	{
+		idle_count = 0;
+		current_sleep = std::chrono::microseconds(1);
+	}
+
+	//tells the core this thread is spinning
+	static void cpuRelax()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+private:
+
+	const int spins;
+	const int yields;
+	const std::chrono::microseconds max_sleep;
+	int idle_count;
+	std::chrono::microseconds current_sleep;
+};
+
+#endif
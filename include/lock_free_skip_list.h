@@ -0,0 +1,485 @@
+#ifndef LOCKFREESKIPLIST_H_
+#define LOCKFREESKIPLIST_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "cyclic_buffer.h"
+#include "lock_free_stack.h"
+#include "memory_reclamation.h"
+
+#define SKIPLIST_MAX_HEIGHT 24
+#define SKIPLIST_NODES_PER_BLOCK 512
+#define SKIPLIST_MIN_NODES_PER_BLOCK 8
+
+template <class K, class V>
+class SkipListNodePool;
+
+template <class K, class V>
+struct SkipListNode
+{
+	SkipListNode(SkipListNodePool<K, V> * _pool, const int _height)
+	: next(nullptr)
+	, references(0)
+	, pool(_pool)
+	, height(_height)
+	{
+		for(int level = 0; level < height; ++level)
+			new (&links()[level]) std::atomic<uintptr_t>(0);
+	}
+
+	//the links of the levels follow the node in the memory of its pool block
+	std::atomic<uintptr_t> * links()
+	{
+		return reinterpret_cast<std::atomic<uintptr_t> *>(this + 1);
+	}
+
+	K& key()
+	{
+		return *reinterpret_cast<K *>(&key_storage);
+	}
+
+	V& value()
+	{
+		return *reinterpret_cast<V *>(&value_storage);
+	}
+
+	static size_t stride(const int height)
+	{
+		const size_t size = sizeof(SkipListNode<K, V>) + sizeof(std::atomic<uintptr_t>) * height;
+		return (size + alignof(SkipListNode<K, V>) - 1) & ~(alignof(SkipListNode<K, V>) - 1);
+	}
+
+	std::atomic<SkipListNode<K, V> *> next; /* link of the pool free list */
+	std::atomic<int> references; /* the inserter and the eraser , the last one to let go retires the node */
+	SkipListNodePool<K, V> * const pool;
+	const int height;
+	typename std::aligned_storage<sizeof(K), alignof(K)>::type key_storage;
+	typename std::aligned_storage<sizeof(V), alignof(V)>::type value_storage;
+};
+
+/*
+ * nodes of every height come from blocks owned by the pool and go back to a free list of their height
+ * the memory returns to the system only when the pool is destroyed
+ */
+template <class K, class V>
+class SkipListNodePool
+{
+public:
+
+	using Node = SkipListNode<K, V>;
+
+	SkipListNodePool()
+	{
+	}
+
+	SkipListNodePool(SkipListNodePool&) = delete;
+
+	~SkipListNodePool()
+	{
+		for(auto& block : blocks)
+			::operator delete(block, std::align_val_t(alignof(Node)));
+	}
+
+	Node * allocate(const int height)
+	{
+		Node * node = free_lists[height - 1].nodes.pop();
+		if(likely(node != nullptr))
+			return node;
+		return allocateBlock(height);
+	}
+
+	void release(Node * node)
+	{
+		free_lists[node->height - 1].nodes.push(node);
+	}
+
+private:
+
+	struct FreeList
+	{
+		TaggedNodeList<Node> nodes;
+		char padding[CACHE_LINE_SIZE - sizeof(TaggedNodeList<Node>)];
+	};
+
+	//high nodes are rare so their blocks are smaller
+	Node * allocateBlock(const int height)
+	{
+		const size_t count = std::max<size_t>(SKIPLIST_MIN_NODES_PER_BLOCK, SKIPLIST_NODES_PER_BLOCK >> (height - 1));
+		const size_t stride = Node::stride(height);
+		char * block = static_cast<char *>(::operator new(stride * count, std::align_val_t(alignof(Node))));
+		{
+			std::lock_guard<std::mutex> lock(blocks_locker);
+			blocks.push_back(block);
+		}
+		for(size_t i = 1; i < count; ++i)
+			release(new (block + stride * i) Node(this, height));
+		return new (block) Node(this, height);
+	}
+
+	FreeList free_lists[SKIPLIST_MAX_HEIGHT];
+	std::mutex blocks_locker;
+	std::vector<char *> blocks;
+};
+
+/*
+ * lock free ordered map , insert , erase , find , ordered iteration and popMin never take a lock
+ * every level is a linked list whose links carry a deleted mark in their lowest bit , erase marks the links of a
+ * node from the top level down and the thread that marks the lowest level owns the erase , traversals unlink the
+ * marked nodes they pass
+ * an inserted value never changes , insert returns false when the key is already in the list
+ * every operation pins the list's EpochDomain , an unlinked node is retired to it and returns to the node pool once
+ * no thread can still read it , so inserts take nodes from the pool instead of the global allocator
+ */
+template <class K, class V, class Compare = std::less<K>>
+class LockFreeSkipList
+{
+public:
+
+	LockFreeSkipList()
+	: head(pool.allocate(SKIPLIST_MAX_HEIGHT))
+	{
+	}
+
+	LockFreeSkipList(LockFreeSkipList&) = delete;
+
+	~LockFreeSkipList()
+	{
+		Node * node = pointer(head->links()[0].load(MEM_RELAXED));
+		while(node != nullptr)
+		{
+			Node * next = pointer(node->links()[0].load(MEM_RELAXED));
+			destroyNode(node);
+			node = next;
+		}
+	}
+
+	//returns true when the key was inserted and false when it is already in the list
+	bool insert(const K& key, const V& value)
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		Node * preds[SKIPLIST_MAX_HEIGHT];
+		Node * succs[SKIPLIST_MAX_HEIGHT];
+		Node * node = nullptr;
+		while(true)
+		{
+			if(find(key, preds, succs))
+			{
+				if(node != nullptr)
+				{
+					destroyNode(node);
+					pool.release(node);
+				}
+				return false;
+			}
+			if(node == nullptr)
+			{
+				node = pool.allocate(randomHeight());
+				new (&node->key()) K(key);
+				new (&node->value()) V(value);
+				node->references.store(2, MEM_RELAXED);
+			}
+			for(int level = 0; level < node->height; ++level)
+				node->links()[level].store(pack(succs[level]), MEM_RELAXED);
+			uintptr_t expected = pack(succs[0]);
+			if(preds[0]->links()[0].compare_exchange_strong(expected, pack(node), MEM_RELEASE, MEM_RELAXED))
+				break;
+		}
+		linkLevels(node, preds, succs);
+		releaseReference(node);
+		return true;
+	}
+
+	bool erase(const K& key)
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		Node * preds[SKIPLIST_MAX_HEIGHT];
+		Node * succs[SKIPLIST_MAX_HEIGHT];
+		if(!find(key, preds, succs))
+			return false;
+		Node * node = succs[0];
+		if(!markNode(node))
+			return false;
+		releaseReference(node);
+		return true;
+	}
+
+	bool find(const K& key, V& value)
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		Node * node = lowerBound(key);
+		if(node == nullptr || compare(key, node->key()))
+			return false;
+		value = node->value();
+		return true;
+	}
+
+	bool contains(const K& key)
+	{
+		V value;
+		return find(key, value);
+	}
+
+	//removes the smallest key , returns false when the list is empty
+	bool popMin(K& key, V& value)
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		while(true)
+		{
+			Node * node = firstNode();
+			if(node == nullptr)
+				return false;
+			if(markNode(node))
+			{
+				key = node->key();
+				value = node->value();
+				releaseReference(node);
+				return true;
+			}
+		}
+	}
+
+	/*
+	 * calls function(const K&, const V&) for every key in order , keys inserted or erased while the iteration runs
+	 * may or may not be seen , function returning false stops the iteration
+	 */
+	template <typename Functor>
+	void forEach(const Functor& function)
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		for(Node * node = firstNode(); node != nullptr; node = nextNode(node))
+			if(!function(static_cast<const K&>(node->key()), static_cast<const V&>(node->value())))
+				return;
+	}
+
+	bool empty()
+	{
+		EpochDomain::Guard guard(epoch_domain);
+		return firstNode() == nullptr;
+	}
+
+private:
+
+	using Node = SkipListNode<K, V>;
+
+	static Node * pointer(const uintptr_t link)
+	{
+		return reinterpret_cast<Node *>(link & ~uintptr_t(1));
+	}
+
+	static bool isMarked(const uintptr_t link)
+	{
+		return (link & 1) != 0;
+	}
+
+	static uintptr_t pack(Node * node)
+	{
+		return reinterpret_cast<uintptr_t>(node);
+	}
+
+	static int randomHeight()
+	{
+		static thread_local uint32_t state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return std::min(__builtin_ctz(state | (1u << 31)) + 1, SKIPLIST_MAX_HEIGHT);
+	}
+
+	static void destroyNode(Node * node)
+	{
+		node->key().~K();
+		node->value().~V();
+	}
+
+	static void reclaimNode(void * retired)
+	{
+		Node * node = static_cast<Node *>(retired);
+		destroyNode(node);
+		node->pool->release(node);
+	}
+
+	/*
+	 * fills preds and succs with the last node before key and the first node not before key on every level and
+	 * unlinks the marked nodes on the way , returns true when an unmarked node with key is in the lowest level
+	 */
+	bool find(const K& key, Node ** preds, Node ** succs)
+	{
+	retry:
+		Node * pred = head;
+		for(int level = SKIPLIST_MAX_HEIGHT - 1; level >= 0; --level)
+		{
+			Node * current = pointer(pred->links()[level].load(MEM_ACQUIRE));
+			while(current != nullptr)
+			{
+				uintptr_t next = current->links()[level].load(MEM_ACQUIRE);
+				while(isMarked(next))
+				{
+					uintptr_t expected = pack(current);
+					if(!pred->links()[level].compare_exchange_strong(expected, next & ~uintptr_t(1),
+							MEM_ACQ_REL, MEM_RELAXED))
+						goto retry;
+					current = pointer(next);
+					if(current == nullptr)
+						break;
+					next = current->links()[level].load(MEM_ACQUIRE);
+				}
+				if(current == nullptr || !compare(current->key(), key))
+					break;
+				pred = current;
+				current = pointer(next);
+			}
+			preds[level] = pred;
+			succs[level] = current;
+		}
+		return succs[0] != nullptr && !compare(key, succs[0]->key());
+	}
+
+	//the first unmarked node not before key without unlinking anything , readers never write
+	Node * lowerBound(const K& key)
+	{
+		Node * pred = head;
+		Node * current = nullptr;
+		for(int level = SKIPLIST_MAX_HEIGHT - 1; level >= 0; --level)
+		{
+			current = pointer(pred->links()[level].load(MEM_ACQUIRE));
+			while(current != nullptr)
+			{
+				const uintptr_t next = current->links()[level].load(MEM_ACQUIRE);
+				if(isMarked(next))
+				{
+					current = pointer(next);
+					continue;
+				}
+				if(!compare(current->key(), key))
+					break;
+				pred = current;
+				current = pointer(next);
+			}
+		}
+		return current;
+	}
+
+	Node * firstNode()
+	{
+		return skipMarked(pointer(head->links()[0].load(MEM_ACQUIRE)));
+	}
+
+	Node * nextNode(Node * node)
+	{
+		return skipMarked(pointer(node->links()[0].load(MEM_ACQUIRE)));
+	}
+
+	static Node * skipMarked(Node * node)
+	{
+		while(node != nullptr)
+		{
+			const uintptr_t next = node->links()[0].load(MEM_ACQUIRE);
+			if(!isMarked(next))
+				return node;
+			node = pointer(next);
+		}
+		return nullptr;
+	}
+
+	//links the levels above the lowest , stops when the node is erased meanwhile
+	void linkLevels(Node * node, Node ** preds, Node ** succs)
+	{
+		for(int level = 1; level < node->height; ++level)
+		{
+			while(true)
+			{
+				uintptr_t current = node->links()[level].load(MEM_ACQUIRE);
+				if(isMarked(current))
+					return;
+				if(pointer(current) != succs[level]
+						&& !node->links()[level].compare_exchange_strong(current, pack(succs[level]),
+								MEM_RELEASE, MEM_RELAXED))
+					continue;
+				uintptr_t expected = pack(succs[level]);
+				if(preds[level]->links()[level].compare_exchange_strong(expected, pack(node), MEM_RELEASE, MEM_RELAXED))
+					break;
+				find(node->key(), preds, succs);
+				if(succs[0] != node)
+					return;
+			}
+		}
+	}
+
+	//marks every level from the top down , returns true when this thread marked the lowest level
+	static bool markNode(Node * node)
+	{
+		for(int level = node->height - 1; level > 0; --level)
+			node->links()[level].fetch_or(1, MEM_ACQ_REL);
+		uintptr_t current = node->links()[0].load(MEM_ACQUIRE);
+		while(!isMarked(current))
+		{
+			if(node->links()[0].compare_exchange_weak(current, current | 1, MEM_ACQ_REL, MEM_ACQUIRE))
+				return true;
+		}
+		return false;
+	}
+
+	/*
+	 * once both the inserter finished linking and the eraser marked the node no level can gain a new link to it ,
+	 * it is unlinked from every level it is still on and only then retired
+	 */
+	void releaseReference(Node * node)
+	{
+		if(node->references.fetch_sub(1, MEM_ACQ_REL) != 1)
+			return;
+		unlink(node);
+		epoch_domain.retire(node, &reclaimNode);
+	}
+
+	/*
+	 * like find but looks for node itself , a node inserted again with the same key can be linked before the marked
+	 * one on the upper levels , so every level is walked past the equal keys until node or a bigger key
+	 */
+	void unlink(Node * node)
+	{
+		const K& key = node->key();
+	retry:
+		Node * pred = head;
+		for(int level = SKIPLIST_MAX_HEIGHT - 1; level >= 0; --level)
+		{
+			Node * before = pred;
+			Node * current = pointer(before->links()[level].load(MEM_ACQUIRE));
+			while(current != nullptr)
+			{
+				const uintptr_t next = current->links()[level].load(MEM_ACQUIRE);
+				if(isMarked(next))
+				{
+					uintptr_t expected = pack(current);
+					if(!before->links()[level].compare_exchange_strong(expected, next & ~uintptr_t(1),
+							MEM_ACQ_REL, MEM_RELAXED))
+						goto retry;
+					if(current == node)
+						break;
+					current = pointer(next);
+					continue;
+				}
+				if(compare(key, current->key()))
+					break;
+				if(compare(current->key(), key))
+					pred = current;
+				before = current;
+				current = pointer(next);
+			}
+		}
+	}
+
+	Compare compare;
+	SkipListNodePool<K, V> pool;
+	Node * head;
+	char padding1[CACHE_LINE_SIZE]; /* keep the head links away from the epoch domain */
+	EpochDomain epoch_domain;
+};
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef LOCKFREESTACK_H_
+#define LOCKFREESTACK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "cyclic_buffer.h"
+#include "idle_strategy.h"
+
+#define STACK_TAG_SHIFT 48
+#define STACK_POINTER_MASK ((uint64_t(1) << STACK_TAG_SHIFT) - 1)
+#define STACK_NODES_PER_BLOCK 1024
+#define STACK_FREE_LISTS 8
+#define DEFAULT_ELIMINATION_SIZE 8
+#define DEFAULT_ELIMINATION_SPINS 64
+
+/*
+ * a pointer packed with a 16 bit version in the bits above the 48 bit user space address
+ * every successful compare and swap bumps the version so a pointer that was popped and pushed back between a load
+ * and the compare and swap does not match anymore (ABA)
+ */
+template <class Node>
+class TaggedPointer
+{
+public:
+
+	static Node * pointer(const uint64_t tagged)
+	{
+		return reinterpret_cast<Node *>(tagged & STACK_POINTER_MASK);
+	}
+
+	//packs node with the version after the version of previous
+	static uint64_t next(Node * node, const uint64_t previous)
+	{
+		return ((previous >> STACK_TAG_SHIFT) + 1) << STACK_TAG_SHIFT | reinterpret_cast<uint64_t>(node);
+	}
+};
+
+template <class T>
+struct StackNode
+{
+	StackNode()
+	: next(nullptr)
+	{
+	}
+
+	T * value()
+	{
+		return reinterpret_cast<T *>(&storage);
+	}
+
+	std::atomic<StackNode<T> *> next; /* may be read after the node was popped by another thread , never freed */
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+};
+
+/*
+ * Treiber stack over intrusive nodes , nodes are never returned to the system while the list lives so reading
+ * the next pointer of a node another thread already popped is safe and the tagged top makes such a pop fail
+ */
+template <class Node>
+class TaggedNodeList
+{
+public:
+
+	TaggedNodeList()
+	: top(0)
+	{
+	}
+
+	//one attempt , returns false when another thread changed the top
+	bool tryPush(Node * node)
+	{
+		uint64_t current = top.load(MEM_RELAXED);
+		node->next.store(TaggedPointer<Node>::pointer(current), MEM_RELAXED);
+		return top.compare_exchange_strong(current, TaggedPointer<Node>::next(node, current), MEM_RELEASE, MEM_RELAXED);
+	}
+
+	void push(Node * node)
+	{
+		uint64_t current = top.load(MEM_RELAXED);
+		do
+		{
+			node->next.store(TaggedPointer<Node>::pointer(current), MEM_RELAXED);
+		}
+		while(!top.compare_exchange_weak(current, TaggedPointer<Node>::next(node, current), MEM_RELEASE, MEM_RELAXED));
+	}
+
+	//one attempt , returns false when another thread changed the top , node is nullptr when the list is empty
+	bool tryPop(Node *& node)
+	{
+		uint64_t current = top.load(MEM_ACQUIRE);
+		node = TaggedPointer<Node>::pointer(current);
+		if(node == nullptr)
+			return true;
+		Node * next = node->next.load(MEM_RELAXED);
+		if(top.compare_exchange_strong(current, TaggedPointer<Node>::next(next, current), MEM_ACQUIRE, MEM_RELAXED))
+			return true;
+		node = nullptr;
+		return false;
+	}
+
+	Node * pop()
+	{
+		Node * node;
+		while(!tryPop(node));
+		return node;
+	}
+
+	bool empty() const
+	{
+		return TaggedPointer<Node>::pointer(top.load(MEM_ACQUIRE)) == nullptr;
+	}
+
+private:
+
+	std::atomic<uint64_t> top;
+};
+
+/*
+ * lock free LIFO stack , ABA safe through a tagged top pointer
+ * nodes come from blocks owned by the stack and go back to internal free lists after a pop , so the hot path never
+ * touches the global allocator once the stack reached its peak size and memory is freed only by the destructor
+ * the free lists are sharded by thread so recycling nodes does not make a second contended top pointer
+ * a push or pop that loses the race on the top tries the elimination array , a push parks its node in a random
+ * slot for a few spins and a pop that finds it takes the node , the pair cancels without touching the top pointer
+ * so throughput keeps rising with the threads count instead of collapsing on one cache line
+ * an elimination_size of 0 turns the elimination array off and every push and pop retries on the top
+ */
+template <class T>
+class LockFreeStack
+{
+public:
+
+	LockFreeStack(const size_t _elimination_size = DEFAULT_ELIMINATION_SIZE,
+			const int _elimination_spins = DEFAULT_ELIMINATION_SPINS)
+	: elimination_size(_elimination_size)
+	, elimination_spins(_elimination_spins)
+	, elimination(new EliminationSlot[_elimination_size])
+	{
+	}
+
+	LockFreeStack(LockFreeStack&) = delete;
+
+	~LockFreeStack()
+	{
+		Node * node;
+		while((node = stack.pop()) != nullptr)
+			node->value()->~T();
+	}
+
+	void push(const T& element)
+	{
+		Node * node = allocateNode();
+		new (node->value()) T(element);
+		pushNode(node);
+	}
+
+	void push(T&& element)
+	{
+		Node * node = allocateNode();
+		new (node->value()) T(std::move(element));
+		pushNode(node);
+	}
+
+	template <typename... Args>
+	void emplace(Args&&... args)
+	{
+		Node * node = allocateNode();
+		new (node->value()) T(std::forward<Args>(args)...);
+		pushNode(node);
+	}
+
+	bool pop()
+	{
+		return consumeOne([](T&&){});
+	}
+
+	bool tryPop(T& element)
+	{
+		return consumeOne([&element](T&& current){
+			element = std::move(current);
+		});
+	}
+
+	std::unique_ptr<T> tryPop()
+	{
+		T * returned_element = nullptr;
+		consumeOne([&returned_element](T&& current){
+			returned_element = new T(std::move(current));
+		});
+		return std::unique_ptr<T>(returned_element);
+	}
+
+	//returns true when an element was popped and handed to function otherwise false
+	template <typename Functor>
+	bool consumeOne(const Functor& function)
+	{
+		Node * node = popNode();
+		if(node == nullptr)
+			return false;
+		function(std::move(*node->value()));
+		node->value()->~T();
+		free_lists[threadIndex()].nodes.push(node);
+		return true;
+	}
+
+	bool empty() const
+	{
+		return stack.empty();
+	}
+
+private:
+
+	using Node = StackNode<T>;
+
+	struct FreeList
+	{
+		TaggedNodeList<Node> nodes;
+		char padding[CACHE_LINE_SIZE - sizeof(TaggedNodeList<Node>)];
+	};
+
+	struct EliminationSlot
+	{
+		EliminationSlot()
+		: exchange(0)
+		{
+		}
+
+		std::atomic<uint64_t> exchange; /* the parked node of a push or nullptr , tagged like the top */
+		char padding[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+	};
+
+	void pushNode(Node * node)
+	{
+		while(!stack.tryPush(node))
+		{
+			if(elimination_size != 0 && eliminatePush(node))
+				return;
+		}
+	}
+
+	Node * popNode()
+	{
+		Node * node;
+		while(!stack.tryPop(node))
+		{
+			if(elimination_size != 0 && (node = eliminatePop()) != nullptr)
+				return node;
+		}
+		return node;
+	}
+
+	//returns true when a pop took the node
+	bool eliminatePush(Node * node)
+	{
+		EliminationSlot& slot = randomSlot();
+		uint64_t current = slot.exchange.load(MEM_RELAXED);
+		if(TaggedPointer<Node>::pointer(current) != nullptr)
+			return false;
+		const uint64_t offered = TaggedPointer<Node>::next(node, current);
+		if(!slot.exchange.compare_exchange_strong(current, offered, MEM_RELEASE, MEM_RELAXED))
+			return false;
+		for(int i = 0; i < elimination_spins; ++i)
+		{
+			//only a pop changes a slot that holds a node
+			if(slot.exchange.load(MEM_RELAXED) != offered)
+				return true;
+			AdaptiveIdleStrategy::cpuRelax();
+		}
+		current = offered;
+		return !slot.exchange.compare_exchange_strong(current, TaggedPointer<Node>::next(nullptr, offered),
+				MEM_RELAXED, MEM_RELAXED);
+	}
+
+	Node * eliminatePop()
+	{
+		EliminationSlot& slot = randomSlot();
+		for(int i = 0; i < elimination_spins; ++i)
+		{
+			uint64_t current = slot.exchange.load(MEM_RELAXED);
+			Node * node = TaggedPointer<Node>::pointer(current);
+			if(node != nullptr)
+			{
+				if(slot.exchange.compare_exchange_strong(current, TaggedPointer<Node>::next(nullptr, current),
+						MEM_ACQUIRE, MEM_RELAXED))
+					return node;
+				return nullptr;
+			}
+			AdaptiveIdleStrategy::cpuRelax();
+		}
+		return nullptr;
+	}
+
+	EliminationSlot& randomSlot()
+	{
+		static thread_local uint32_t state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return elimination[state % elimination_size];
+	}
+
+	static size_t threadIndex()
+	{
+		static thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % STACK_FREE_LISTS;
+		return index;
+	}
+
+	//takes a node from the free list of this thread , then from the others and allocates a new block last
+	Node * allocateNode()
+	{
+		const size_t home = threadIndex();
+		for(size_t i = 0; i < STACK_FREE_LISTS; ++i)
+		{
+			Node * node = free_lists[(home + i) % STACK_FREE_LISTS].nodes.pop();
+			if(likely(node != nullptr))
+				return node;
+		}
+		Node * block = new Node[STACK_NODES_PER_BLOCK];
+		{
+			std::lock_guard<std::mutex> lock(blocks_locker);
+			blocks.emplace_back(block);
+		}
+		for(size_t i = 1; i < STACK_NODES_PER_BLOCK; ++i)
+			free_lists[home].nodes.push(&block[i]);
+		return &block[0];
+	}
+
+	TaggedNodeList<Node> stack;
+	char padding1[CACHE_LINE_SIZE]; /* keep the top of the stack away from the free lists */
+	FreeList free_lists[STACK_FREE_LISTS];
+	const size_t elimination_size;
+	const int elimination_spins;
+	std::unique_ptr<EliminationSlot[]> elimination;
+	std::mutex blocks_locker;
+	std::vector<std::unique_ptr<Node[]>> blocks;
+};
+
+#endif
@@ -0,0 +1,512 @@
+#ifndef MEMORYRECLAMATION_H_
+#define MEMORYRECLAMATION_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "cyclic_buffer.h"
+
+#define RECLAMATION_COLLECT_THRESHOLD 64
+#define RECLAMATION_COLLECT_BYTES (1 << 20)
+#define HAZARD_POINTERS_PER_THREAD 4
+
+/*
+ * safe memory reclamation for the lock free structures of the library
+ * EpochDomain is the default , readers pin the domain with a Guard and retired pointers are freed once every pinned
+ * thread moved two epochs past the retire , a thread that stays pinned holds back all the garbage of the domain
+ * HazardPointerDomain is the optional scheme for structures that cannot let a stalled reader hold memory , readers
+ * publish every pointer they dereference and the garbage is bounded by the number of published pointers
+ * every thread gets its own record with its own retire list so retiring never touches shared state
+ */
+
+struct RetiredPointer
+{
+	void * pointer;
+	void (* deleter)(void *);
+
+	void reclaim() const
+	{
+		deleter(pointer);
+	}
+};
+
+struct ThreadRecord
+{
+	ThreadRecord()
+	: in_use(true)
+	, next(nullptr)
+	{
+	}
+
+	std::atomic<bool> in_use;
+	ThreadRecord * next;
+};
+
+/*
+ * every domain keeps a list of thread records , a thread finds its record through a thread local cache and gives it
+ * back to the domain when it exits , the garbage left in the record is adopted by the next thread that takes it
+ * unregistering a domain bumps a generation , a thread that sees it moved drops the entries of dead domains from its
+ * cache before adding a new one so the cache never holds more than the live domains
+ */
+class ReclamationRegistry
+{
+public:
+
+	static const uint64_t registerDomain()
+	{
+		std::lock_guard<std::mutex> lock(mutex());
+		const uint64_t id = ++lastDomainId();
+		liveDomains().push_back(id);
+		return id;
+	}
+
+	static void unregisterDomain(const uint64_t id)
+	{
+		std::lock_guard<std::mutex> lock(mutex());
+		auto& domains = liveDomains();
+		domains.erase(std::remove(domains.begin(), domains.end(), id), domains.end());
+		generation().fetch_add(1, MEM_RELEASE);
+	}
+
+	static ThreadRecord * cachedRecord(const uint64_t id)
+	{
+		ThreadCache& cache = threadCache();
+		if(likely(cache.last_id == id))
+			return cache.last_record;
+		for(auto& entry : cache.records)
+		{
+			if(entry.first == id)
+			{
+				cache.last_id = id;
+				cache.last_record = entry.second;
+				return entry.second;
+			}
+		}
+		return nullptr;
+	}
+
+	static void cacheRecord(const uint64_t id, ThreadRecord * record)
+	{
+		ThreadCache& cache = threadCache();
+		if(unlikely(cache.generation != generation().load(MEM_ACQUIRE)))
+			cache.dropDeadDomains();
+		cache.records.emplace_back(id, record);
+		cache.last_id = id;
+		cache.last_record = record;
+	}
+
+private:
+
+	struct ThreadCache
+	{
+		ThreadCache()
+		: last_id(0)
+		, last_record(nullptr)
+		, generation(0)
+		{
+		}
+
+		~ThreadCache()
+		{
+			std::lock_guard<std::mutex> lock(mutex());
+			auto& domains = liveDomains();
+			for(auto& entry : records)
+				if(std::find(domains.begin(), domains.end(), entry.first) != domains.end())
+					entry.second->in_use.store(false, MEM_RELEASE);
+		}
+
+		//the records of dead domains were freed with them so they are only forgotten here
+		void dropDeadDomains()
+		{
+			std::lock_guard<std::mutex> lock(mutex());
+			auto& domains = liveDomains();
+			generation = ReclamationRegistry::generation().load(MEM_RELAXED);
+			records.erase(std::remove_if(records.begin(), records.end(),
+					[&domains](const std::pair<uint64_t, ThreadRecord *>& entry) {
+				return std::find(domains.begin(), domains.end(), entry.first) == domains.end();
+			}), records.end());
+		}
+
+		uint64_t last_id;
+		ThreadRecord * last_record;
+		uint64_t generation; /* the registry generation the cache was last pruned at */
+		std::vector<std::pair<uint64_t, ThreadRecord *>> records;
+	};
+
+	static ThreadCache& threadCache()
+	{
+		static thread_local ThreadCache cache;
+		return cache;
+	}
+
+	static std::mutex& mutex()
+	{
+		static std::mutex registry_mutex;
+		return registry_mutex;
+	}
+
+	static std::atomic<uint64_t>& generation()
+	{
+		static std::atomic<uint64_t> unregistered(0);
+		return unregistered;
+	}
+
+	static uint64_t& lastDomainId()
+	{
+		static uint64_t last_id = 0;
+		return last_id;
+	}
+
+	static std::vector<uint64_t>& liveDomains()
+	{
+		static std::vector<uint64_t> domains;
+		return domains;
+	}
+};
+
+template <class Record>
+class ReclamationDomain
+{
+public:
+
+	ReclamationDomain()
+	: id(ReclamationRegistry::registerDomain())
+	, records(nullptr)
+	{
+	}
+
+	ReclamationDomain(ReclamationDomain&) = delete;
+	ReclamationDomain(ReclamationDomain&&) = delete;
+
+	//the domain must be quiescent , every pointer still retired in it is freed here
+	~ReclamationDomain()
+	{
+		ReclamationRegistry::unregisterDomain(id);
+		Record * record = records.load(MEM_ACQUIRE);
+		while(record != nullptr)
+		{
+			Record * next = static_cast<Record *>(record->next);
+			record->reclaimAll();
+			delete record;
+			record = next;
+		}
+	}
+
+protected:
+
+	Record& threadRecord()
+	{
+		ThreadRecord * record = ReclamationRegistry::cachedRecord(id);
+		if(likely(record != nullptr))
+			return *static_cast<Record *>(record);
+		return acquireRecord();
+	}
+
+	template <typename Functor>
+	void forEachRecord(const Functor& function) const
+	{
+		for(Record * record = records.load(MEM_ACQUIRE); record != nullptr; record = static_cast<Record *>(record->next))
+			function(*record);
+	}
+
+private:
+
+	Record& acquireRecord()
+	{
+		Record * record = records.load(MEM_ACQUIRE);
+		for(; record != nullptr; record = static_cast<Record *>(record->next))
+		{
+			bool in_use = false;
+			if(!record->in_use.load(MEM_RELAXED) &&
+					record->in_use.compare_exchange_strong(in_use, true, MEM_ACQUIRE, MEM_RELAXED))
+				break;
+		}
+		if(record == nullptr)
+		{
+			record = new Record();
+			Record * head = records.load(MEM_RELAXED);
+			do
+				record->next = head;
+			while(!records.compare_exchange_weak(head, record, MEM_RELEASE, MEM_RELAXED));
+		}
+		ReclamationRegistry::cacheRecord(id, record);
+		return *record;
+	}
+
+	const uint64_t id;
+	std::atomic<Record *> records;
+};
+
+struct EpochRecord : public ThreadRecord
+{
+	EpochRecord()
+	: epoch(0)
+	, nesting(0)
+	, retired_since_collect(0)
+	, retired_bytes_since_collect(0)
+	{
+		for(int i = 0; i < 3; ++i)
+			bucket_epochs[i] = 0;
+	}
+
+	void reclaimBucket(const int bucket)
+	{
+		for(auto& retired : buckets[bucket])
+			retired.reclaim();
+		buckets[bucket].clear();
+	}
+
+	void reclaimAll()
+	{
+		for(int i = 0; i < 3; ++i)
+			reclaimBucket(i);
+	}
+
+	std::atomic<uint64_t> epoch; /* pinned epoch shifted left by one , the low bit is set while the thread is pinned */
+	int nesting;
+	size_t retired_since_collect;
+	size_t retired_bytes_since_collect;
+	std::vector<RetiredPointer> buckets[3];
+	uint64_t bucket_epochs[3];
+	char padding[CACHE_LINE_SIZE]; /* records are written by their owner on every pin */
+};
+
+class EpochDomain : public ReclamationDomain<EpochRecord>
+{
+public:
+
+	EpochDomain()
+	: global_epoch(2)
+	{
+	}
+
+	class Guard
+	{
+	public:
+
+		Guard(EpochDomain& _domain)
+		: domain(_domain)
+		, record(_domain.pin())
+		{
+		}
+
+		Guard(Guard&) = delete;
+
+		~Guard()
+		{
+			domain.unpin(record);
+		}
+
+	private:
+
+		EpochDomain& domain;
+		EpochRecord& record;
+	};
+
+	/*
+	 * should be called after the pointer was unlinked , it will be freed when no pinned thread can still see it
+	 * bytes is the memory the pointer holds , a collection runs every RECLAMATION_COLLECT_THRESHOLD retires or once
+	 * RECLAMATION_COLLECT_BYTES were retired so a few large objects do not wait for many small ones
+	 */
+	void retire(void * pointer, void (* deleter)(void *), const size_t bytes = 0)
+	{
+		EpochRecord& record = threadRecord();
+		const uint64_t epoch = global_epoch.load(MEM_ACQUIRE);
+		const int bucket = epoch % 3;
+		if(record.bucket_epochs[bucket] != epoch)
+		{
+			record.reclaimBucket(bucket);
+			record.bucket_epochs[bucket] = epoch;
+		}
+		record.buckets[bucket].push_back(RetiredPointer{pointer, deleter});
+		record.retired_bytes_since_collect += bytes;
+		if(unlikely(++record.retired_since_collect >= RECLAMATION_COLLECT_THRESHOLD ||
+				record.retired_bytes_since_collect >= RECLAMATION_COLLECT_BYTES))
+			collect(record);
+	}
+
+	template <class T>
+	void retire(T * pointer, const size_t bytes = sizeof(T))
+	{
+		retire(pointer, [](void * retired) {
+			delete static_cast<T *>(retired);
+		}, bytes);
+	}
+
+	//tries to advance the epoch and frees what the current thread retired two epochs ago
+	void collect()
+	{
+		collect(threadRecord());
+	}
+
+private:
+
+	EpochRecord& pin()
+	{
+		EpochRecord& record = threadRecord();
+		if(record.nesting++ == 0)
+		{
+			record.epoch.store((global_epoch.load(MEM_RELAXED) << 1) | 1, MEM_RELAXED);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+		return record;
+	}
+
+	void unpin(EpochRecord& record)
+	{
+		if(--record.nesting == 0)
+			record.epoch.store(0, MEM_RELEASE);
+	}
+
+	void collect(EpochRecord& record)
+	{
+		record.retired_since_collect = 0;
+		record.retired_bytes_since_collect = 0;
+		tryAdvance();
+		const uint64_t epoch = global_epoch.load(MEM_ACQUIRE);
+		for(int i = 0; i < 3; ++i)
+			if(record.bucket_epochs[i] + 2 <= epoch)
+				record.reclaimBucket(i);
+	}
+
+	void tryAdvance()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint64_t epoch = global_epoch.load(MEM_RELAXED);
+		bool can_advance = true;
+		forEachRecord([&](const EpochRecord& record) {
+			const uint64_t pinned = record.epoch.load(MEM_ACQUIRE);
+			if((pinned & 1) && (pinned >> 1) != epoch)
+				can_advance = false;
+		});
+		if(can_advance)
+			global_epoch.compare_exchange_strong(epoch, epoch + 1, MEM_ACQ_REL, MEM_RELAXED);
+	}
+
+	std::atomic<uint64_t> global_epoch;
+};
+
+struct HazardRecord : public ThreadRecord
+{
+	HazardRecord()
+	: protected_count(0)
+	{
+		for(int i = 0; i < HAZARD_POINTERS_PER_THREAD; ++i)
+			hazards[i].store(nullptr, MEM_RELAXED);
+	}
+
+	void reclaimAll()
+	{
+		for(auto& retired : retired_pointers)
+			retired.reclaim();
+		retired_pointers.clear();
+	}
+
+	std::atomic<void *> hazards[HAZARD_POINTERS_PER_THREAD];
+	std::vector<RetiredPointer> retired_pointers;
+	std::vector<void *> protected_pointers; /* scratch space of scan */
+	size_t protected_count;
+	char padding[CACHE_LINE_SIZE];
+};
+
+class HazardPointerDomain : public ReclamationDomain<HazardRecord>
+{
+public:
+
+	/*
+	 * owns one hazard slot of the current thread , protect publishes the pointer and rereads the source until it is
+	 * stable , the pointer stays safe to dereference until reset or the holder is destroyed
+	 */
+	class Holder
+	{
+	public:
+
+		Holder(HazardPointerDomain& domain, const int _index)
+		: hazard(domain.threadRecord().hazards[_index])
+		{
+		}
+
+		Holder(Holder&) = delete;
+
+		~Holder()
+		{
+			reset();
+		}
+
+		template <class T>
+		T * protect(const std::atomic<T *>& source)
+		{
+			T * pointer = source.load(MEM_RELAXED);
+			while(true)
+			{
+				hazard.store(pointer, MEM_RELAXED);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				T * current = source.load(MEM_ACQUIRE);
+				if(likely(current == pointer))
+					return pointer;
+				pointer = current;
+			}
+		}
+
+		void reset()
+		{
+			hazard.store(nullptr, MEM_RELEASE);
+		}
+
+	private:
+
+		std::atomic<void *>& hazard;
+	};
+
+	void retire(void * pointer, void (* deleter)(void *))
+	{
+		HazardRecord& record = threadRecord();
+		record.retired_pointers.push_back(RetiredPointer{pointer, deleter});
+		if(unlikely(record.retired_pointers.size() >= RECLAMATION_COLLECT_THRESHOLD + 2 * record.protected_count))
+			scan(record);
+	}
+
+	template <class T>
+	void retire(T * pointer)
+	{
+		retire(pointer, [](void * retired) {
+			delete static_cast<T *>(retired);
+		});
+	}
+
+	void collect()
+	{
+		scan(threadRecord());
+	}
+
+private:
+
+	void scan(HazardRecord& record)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::vector<void *>& protected_pointers = record.protected_pointers;
+		protected_pointers.clear();
+		forEachRecord([&](const HazardRecord& other) {
+			for(int i = 0; i < HAZARD_POINTERS_PER_THREAD; ++i)
+			{
+				void * pointer = other.hazards[i].load(MEM_ACQUIRE);
+				if(pointer != nullptr)
+					protected_pointers.push_back(pointer);
+			}
+		});
+		std::sort(protected_pointers.begin(), protected_pointers.end());
+		record.protected_count = protected_pointers.size();
+		auto kept = std::partition(record.retired_pointers.begin(), record.retired_pointers.end(),
+				[&](const RetiredPointer& retired) {
+					return std::binary_search(protected_pointers.begin(), protected_pointers.end(), retired.pointer);
+				});
+		for(auto it = kept; it != record.retired_pointers.end(); ++it)
+			it->reclaim();
+		record.retired_pointers.erase(kept, record.retired_pointers.end());
+	}
+};
+
+#endif
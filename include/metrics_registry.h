@@ -0,0 +1,69 @@
+#ifndef METRICSREGISTRY_H_
+#define METRICSREGISTRY_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "sharded_counter.h"
+
+/*
+ * named counters and gauges , a queue or a pipeline asks for its metrics once when it is set up and keeps the
+ * reference , the hot path only touches its sharded slots and the registry lock is taken only to create a metric
+ * or to read all of them
+ * metrics live as long as the registry , asking twice for the same name returns the same metric
+ */
+class MetricsRegistry
+{
+public:
+
+	MetricsRegistry()
+	{
+	}
+
+	MetricsRegistry(MetricsRegistry&) = delete;
+
+	//the registry of the process for code that has no registry handed to it
+	static MetricsRegistry& global()
+	{
+		static MetricsRegistry registry;
+		return registry;
+	}
+
+	ShardedCounter& counter(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		auto& metric = counters[name];
+		if(!metric)
+			metric.reset(new ShardedCounter());
+		return *metric;
+	}
+
+	ShardedGauge& gauge(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		auto& metric = gauges[name];
+		if(!metric)
+			metric.reset(new ShardedGauge());
+		return *metric;
+	}
+
+	//calls function(const std::string&, int64_t) for every counter and then every gauge , ordered by name
+	template <typename Functor>
+	void forEach(const Functor& function) const
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		for(auto& metric : counters)
+			function(metric.first, static_cast<int64_t>(metric.second->get()));
+		for(auto& metric : gauges)
+			function(metric.first, metric.second->get());
+	}
+
+private:
+
+	mutable std::mutex locker;
+	std::map<std::string, std::unique_ptr<ShardedCounter>> counters;
+	std::map<std::string, std::unique_ptr<ShardedGauge>> gauges;
+};
+
+#endif
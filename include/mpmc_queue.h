@@ -1,184 +1,235 @@
-
 #ifndef MPMCQUEUE_H_
 #define MPMCQUEUE_H_
 
 #include <atomic>
 #include <array>
+#include <chrono>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <boost/lockfree/detail/branch_hints.hpp>
+#include "consume_budget.h"
 
 
 #define MEM_ACQUIRE std::memory_order_acquire
 #define MEM_RELEASE std::memory_order_release
 #define MEM_RELAXED std::memory_order_relaxed
+#define MEM_ACQ_REL std::memory_order_acq_rel
+#define CACHE_LINE_SIZE 64
 
 using boost::lockfree::detail::likely;
 using boost::lockfree::detail::unlikely;
 using size_t = std::size_t;
 
+/*
+ * bounded queue for any number of producers and consumers , every slot carries a sequence that hands it over
+ * between them , position is free for its producer while the sequence is position , holds a published element
+ * while it is position + 1 and is free for the producer of the next lap once it is position + queue_size
+ * a producer claims its position on writer_position and publishes the slot only after the element was constructed ,
+ * a consumer claims its position on reader_position and frees the slot only after the element was destroyed
+ */
 template<typename T, const size_t queue_size>
 class MpmcQueue
 {
+	static_assert(queue_size > 1, "MpmcQueue needs at least two slots to tell a published slot from a free one");
 
 public:
 	MpmcQueue()
 	: writer_position(0)
 	, reader_position(0)
 	{
-		initalizeQueue();
+		for(size_t i = 0; i < queue_size; ++i)
+			slots[i].sequence.store(i, MEM_RELAXED);
 	}
 
 	MpmcQueue(const MpmcQueue&) = delete;
 	MpmcQueue(MpmcQueue&&) = default;
 
+	//the queue must be quiescent , only the published elements that were not consumed are destroyed
 	~MpmcQueue()
 	{
-		for(int i = 0; i < queue_size; ++i)
-			delete queue[i];		
+		const size_t writer = writer_position.load(MEM_ACQUIRE);
+		for(size_t position = reader_position.load(MEM_ACQUIRE); position != writer; ++position)
+		{
+			Slot& slot = slotAt(position);
+			if(slot.sequence.load(MEM_ACQUIRE) == position + 1)
+				slot.element().~T();
+		}
 	}
 
 	bool push(const T& element)
 	{
-		auto current_position = writer_position.load(MEM_RELAXED);
-		auto next_position = calculateNext(current_position);
-		auto * current_element = queue[current_position];	
-		if(!canWrite(current_position))
-			return false;
-
-		while(!writer_position.compare_exchange_weak(current_position, next_position, MEM_RELEASE, MEM_RELAXED))
-		{	
-			next_position = calculateNext(current_position);
-			current_element = queue[current_position];
-			if(!canWrite(current_position))
-				return false;
-		}
-		new (current_element) T(element);
-		return true;
+		return emplace(element);
 	}
 
 	bool push(T&& element)
 	{
-		auto current_position = writer_position.load(MEM_RELAXED);
-                auto next_position = calculateNext(current_position);
-		auto* current_element = queue[current_position];
-                if(!canWrite(current_position))
-                        return false;
-
-                while(!writer_position.compare_exchange_weak(current_position, next_position, MEM_RELEASE, MEM_RELAXED))
-                {
-			next_position = calculateNext(current_position);
-			current_element = queue[current_position];
-                	if(!canWrite(current_position))
-				return false;
-		}	
-		new (current_element)  T(std::move(element));
-		return true;
-
+		return emplace(std::move(element));
 	}
 
 	bool pop()
 	{
-		auto current_position = reader_position.load(MEM_RELAXED);
-                auto next_position = calculateNext(current_position);
-		auto& current_element = *queue[current_position];
-		if(!canRead(current_position))
-			return false;
+		return consumeOne([](T&&){});
+	}
 
-		while(!reader_position.compare_exchange_weak(current_position, next_position, MEM_RELEASE, MEM_RELAXED))
+	/*
+	 * function gets the element at the head , when it returns true the element is popped otherwise it stays at the
+	 * head , the head is locked while function runs so the other consumers wait for it
+	 */
+	template<typename Functor>
+	bool popOnSuccses(const Functor& function)
+	{
+		size_t position = lockReader();
+		Slot& slot = slotAt(position);
+		if(slot.sequence.load(MEM_ACQUIRE) != position + 1 || !function(static_cast<const T&>(slot.element())))
 		{
-                        next_position = calculateNext(current_position);
-			current_element = *queue[current_position];
+			reader_position.store(position, MEM_RELEASE);
+			return false;
 		}
-		current_element.~T();
+		reader_position.store(position + 1, MEM_RELEASE);
+		freeSlot(slot, position);
 		return true;
 	}
 
-	bool popOnSuccses(const std::function<bool(const T&)>& function)
+	//returns true when an element was popped and handed to function otherwise false
+	template<typename Functor>
+	bool consumeOne(const Functor& function)
 	{
+		size_t position;
+		Slot * slot = claimRead(position);
+		if(slot == nullptr)
+			return false;
+		function(std::move(slot->element()));
+		freeSlot(*slot, position);
 		return true;
 	}
 
-	void consumeAll(const std::function<void(const T&)>& function)
+	//consumes until the queue looks empty , with busy producers prefer consumeUpTo or consumeFor
+	template<typename Functor>
+	size_t consumeAll(const Functor& function)
 	{
-		//ConsumeAll(function);
+		size_t consumed = 0;
+		while(consumeOne(function))
+			++consumed;
+		return consumed;
 	}
 
 	template<typename Functor>
-	void ConsumeAll(const Functor& function)
-	{
-		auto current_position = reader_position.load(MEM_RELAXED);
-		for(auto current_size = getSizeReader(current_position); current_size > 0; current_size = getSizeReader(current_position))
-                {
-			auto next_position = calculateNext(current_position);
-			auto& current_element = *queue[current_position];
-                        while(!reader_position.compare_exchange_weak(current_position, next_position, MEM_RELEASE, MEM_RELAXED))
-			{
-				next_position = calculateNext(current_position);
-                                current_element = *queue[current_position];
-				if(!canRead(current_position))
-					return;	
-			}
-			function(current_element, current_position);
-			current_element.~T();
-		}
+	size_t consumeUpTo(const size_t max, const Functor& function)
+	{
+		size_t consumed = 0;
+		while(consumed < max && consumeOne(function))
+			++consumed;
+		return consumed;
 	}
 
+	template<typename Functor>
+	size_t consumeFor(const std::chrono::nanoseconds budget, const Functor& function)
+	{
+		return consumeWithBudget(*this, budget, function);
+	}
+
+	//claimed positions , elements still being pushed or consumed are counted too
 	const size_t getSize() const
 	{
-		const auto writer_pos = writer_position.load(MEM_ACQUIRE);
-		const auto reader_pos = reader_position.load(MEM_ACQUIRE);
-		return calculateSize(writer_pos, reader_pos);
+		const size_t reader = reader_position.load(MEM_ACQUIRE) & ~reader_locked;
+		const size_t writer = writer_position.load(MEM_ACQUIRE);
+		return writer > reader ? writer - reader : 0;
 	}
 
 private:
 
-	void initalizeQueue()
+	struct Slot
 	{
-		for(int i = 0; i < queue_size; ++i)
-			queue[i] = new T();
-	}
+		T& element()
+		{
+			return *reinterpret_cast<T *>(&storage);
+		}
 
-	bool canRead(const size_t current_position_reader) const
-        {
-                return !unlikely(getSizeReader(current_position_reader) == 0);
-        }
+		std::atomic<size_t> sequence;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
 
-        bool canWrite(const size_t current_position_writer) const
-        {
-                return !unlikely(getSizeWriter(current_position_writer) == queue_size - 1);
-        }
+	//set on reader_position while popOnSuccses looks at the head
+	static const size_t reader_locked = size_t(1) << (sizeof(size_t) * 8 - 1);
 
+	Slot& slotAt(const size_t position)
+	{
+		return slots[position % queue_size];
+	}
 
-	const size_t calculateNext(const size_t current_position) const
+	template<typename U>
+	bool emplace(U&& element)
 	{
-		size_t ret = current_position + 1;
-                if(unlikely(ret == queue_size))
-                        return 0;
-                return ret;
+		size_t position = writer_position.load(MEM_RELAXED);
+		while(true)
+		{
+			Slot& slot = slotAt(position);
+			const size_t sequence = slot.sequence.load(MEM_ACQUIRE);
+			if(sequence == position)
+			{
+				if(writer_position.compare_exchange_weak(position, position + 1, MEM_RELAXED, MEM_RELAXED))
+				{
+					new (&slot.storage) T(std::forward<U>(element));
+					slot.sequence.store(position + 1, MEM_RELEASE);
+					return true;
+				}
+			}
+			//the consumer of the previous lap did not free the slot yet
+			else if(unlikely(sequence < position))
+				return false;
+			else
+				position = writer_position.load(MEM_RELAXED);
+		}
 	}
-	
-	const size_t calculateSize(const size_t writer, const size_t reader) const
-        {
-                const size_t ret(writer - reader + queue_size);
-                if(writer >= reader)
-                        return ret - queue_size;
-                return ret;
-        }
 
-	const size_t getSizeReader(const size_t reader) const
+	//claims the published element at the head , returns nullptr when the queue is empty
+	Slot * claimRead(size_t& position)
 	{
-		const auto writer = writer_position.load(MEM_ACQUIRE);
-		return calculateSize(writer, reader);
+		position = reader_position.load(MEM_RELAXED);
+		while(true)
+		{
+			if(unlikely(position & reader_locked))
+			{
+				position = reader_position.load(MEM_RELAXED);
+				continue;
+			}
+			Slot& slot = slotAt(position);
+			const size_t sequence = slot.sequence.load(MEM_ACQUIRE);
+			if(sequence == position + 1)
+			{
+				//acquire pairs with the release of popOnSuccses giving the head back after looking at it
+				if(reader_position.compare_exchange_weak(position, position + 1, MEM_ACQUIRE, MEM_RELAXED))
+					return &slot;
+			}
+			else if(sequence < position + 1)
+				return nullptr;
+			else
+				position = reader_position.load(MEM_RELAXED);
+		}
 	}
-	
-	const size_t getSizeWriter(const size_t writer) const
+
+	//takes the head away from the other consumers without claiming it , returns its position
+	size_t lockReader()
+	{
+		size_t position = reader_position.load(MEM_RELAXED);
+		while((position & reader_locked) != 0 ||
+				!reader_position.compare_exchange_weak(position, position | reader_locked, MEM_ACQUIRE, MEM_RELAXED))
+			position = reader_position.load(MEM_RELAXED);
+		return position;
+	}
+
+	void freeSlot(Slot& slot, const size_t position)
 	{
-		const auto reader = reader_position.load(MEM_ACQUIRE);
-		return calculateSize(writer, reader);
+		slot.element().~T();
+		slot.sequence.store(position + queue_size, MEM_RELEASE);
 	}
 
 	std::atomic<size_t> writer_position;
+	char padding1[CACHE_LINE_SIZE]; /* force the producers and the consumers to different cache lines */
 	std::atomic<size_t> reader_position;
-	T* queue[queue_size];
+	char padding2[CACHE_LINE_SIZE];
+	Slot slots[queue_size];
 };
 
 #endif
@@ -0,0 +1,505 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include "idle_strategy.h"
+#include "metrics_registry.h"
+#include "spsc_queue.h"
+
+#define DEFAULT_PIPELINE_QUEUE_SIZE 4096
+#define PIPELINE_DRAIN_BATCH 256
+
+/*
+ * runs a graph of stages , every stage on its own thread optionally pinned to a core
+ * every edge between two stages is its own SpscQueue , a stage with several inputs drains all of them (fan in)
+ * and a stage with several consumers hands its elements round robin to them (fan out)
+ * when a source returns false or stop is called the sources finish , every stage drains its inputs after all its
+ * producers finished and then finishes itself , so shutdown flows down the graph without losing elements
+ * exportMetrics counts the elements every stage took in and emitted in a MetricsRegistry
+ * fan in and fan out stay on one SpscQueue per edge instead of a shared MpmcQueue , every producer keeps its own
+ * batched publish and no producer contends with another on a shared position , the consumer drains the lanes in
+ * turns so one busy producer cannot starve the others , and MpmcQueue takes its size as a template argument while
+ * the pipeline sizes its queues at run time , like the producer lanes feeding the TimerWheel
+ *
+ *	Pipeline pipeline;
+ *	auto numbers = pipeline.source<int>(0, [&](Emitter<int>& out) { out.emit(next()); return more(); });
+ *	auto squares = pipeline.stage<int, int>(numbers, 1, [](int&& value, Emitter<int>& out) { out.emit(value * value); });
+ *	pipeline.sink<int>(squares, 2, [&](int&& value) { total += value; });
+ *	pipeline.start();
+ *	pipeline.join();
+ */
+
+class PipelineStage
+{
+public:
+
+	PipelineStage(const int _core)
+	: core(_core)
+	, finished(false)
+	, in_counter(nullptr)
+	, out_counter(nullptr)
+	{
+	}
+
+	virtual ~PipelineStage()
+	{
+	}
+
+	virtual void run() = 0;
+
+	bool isFinished() const
+	{
+		return finished.load(MEM_ACQUIRE);
+	}
+
+	void exportTo(ShardedCounter * _in_counter, ShardedCounter * _out_counter)
+	{
+		in_counter = _in_counter;
+		out_counter = _out_counter;
+	}
+
+	const int core;
+
+protected:
+
+	void finish()
+	{
+		finished.store(true, MEM_RELEASE);
+	}
+
+	void countIn(const size_t count)
+	{
+		if(in_counter != nullptr && count != 0)
+			in_counter->add(count);
+	}
+
+	void countOut(const size_t count)
+	{
+		if(out_counter != nullptr && count != 0)
+			out_counter->add(count);
+	}
+
+private:
+
+	std::atomic<bool> finished;
+	ShardedCounter * in_counter;
+	ShardedCounter * out_counter;
+};
+
+template <class T>
+class Emitter
+{
+public:
+
+	Emitter(const size_t _queue_size, const PublishPolicy& _policy)
+	: queue_size(_queue_size)
+	, policy(_policy)
+	, next_lane(0)
+	, emitted(0)
+	{
+	}
+
+	Emitter(Emitter<T>&) = delete;
+
+	//blocks with the idle strategy while every consumer lane is full
+	void emit(const T& element)
+	{
+		emitWith([&](SpscQueue<T>& lane) {
+			return lane.push(element);
+		});
+	}
+
+	void emit(T&& element)
+	{
+		emitWith([&](SpscQueue<T>& lane) {
+			return lane.push(std::move(element));
+		});
+	}
+
+	//should be called before the pipeline starts , every consumer gets its own lane
+	SpscQueue<T> * addLane()
+	{
+		lanes.emplace_back(new SpscQueue<T>(queue_size, policy));
+		return lanes.back().get();
+	}
+
+	void flush()
+	{
+		for(auto& lane : lanes)
+			lane->flush();
+	}
+
+	//publishes the lanes whose staged elements waited max_publish_delay
+	void tick()
+	{
+		for(auto& lane : lanes)
+			lane->tick();
+	}
+
+	//returns how many elements were emitted since the last call
+	size_t takeEmitted()
+	{
+		const size_t ret = emitted;
+		emitted = 0;
+		return ret;
+	}
+
+private:
+
+	template <typename Functor>
+	void emitWith(const Functor& push)
+	{
+		const size_t lanes_count = lanes.size();
+		if(unlikely(lanes_count == 0))
+			return;
+		++emitted;
+		AdaptiveIdleStrategy idle;
+		while(true)
+		{
+			for(size_t i = 0; i < lanes_count; ++i)
+			{
+				SpscQueue<T>& lane = *lanes[next_lane];
+				next_lane = next_lane + 1 == lanes_count ? 0 : next_lane + 1;
+				if(likely(push(lane)))
+					return;
+			}
+			idle.idle();
+		}
+	}
+
+	const size_t queue_size;
+	const PublishPolicy policy;
+	std::vector<std::unique_ptr<SpscQueue<T>>> lanes;
+	size_t next_lane;
+	size_t emitted;
+};
+
+template <class T>
+class StageHandle
+{
+public:
+
+	StageHandle(PipelineStage * _stage, Emitter<T> * _output)
+	: stage(_stage)
+	, output(_output)
+	{
+	}
+
+	PipelineStage * stage;
+	Emitter<T> * output;
+};
+
+template <class In>
+class StageInputs
+{
+public:
+
+	StageInputs(const std::vector<StageHandle<In>>& handles)
+	{
+		for(auto& handle : handles)
+		{
+			producers.push_back(handle.stage);
+			lanes.push_back(handle.output->addLane());
+		}
+	}
+
+	bool producersFinished() const
+	{
+		for(auto * producer : producers)
+			if(!producer->isFinished())
+				return false;
+		return true;
+	}
+
+	//takes at most PIPELINE_DRAIN_BATCH elements from every lane so a busy lane does not starve the others
+	template <typename Functor>
+	size_t drain(const Functor& function)
+	{
+		size_t consumed = 0;
+		for(auto * lane : lanes)
+			consumed += lane->consumeUpTo(PIPELINE_DRAIN_BATCH, function);
+		return consumed;
+	}
+
+	/*
+	 * drains until every producer finished and every lane is empty , on_batch gets the count of every drain that
+	 * found elements and on_idle runs before the thread backs off
+	 * the producers are checked before draining so everything they published before finishing is consumed
+	 */
+	template <typename Functor, typename BatchFunctor, typename IdleFunctor>
+	void run(const Functor& function, const BatchFunctor& on_batch, const IdleFunctor& on_idle)
+	{
+		AdaptiveIdleStrategy idle;
+		while(true)
+		{
+			const bool finished = producersFinished();
+			const size_t consumed = drain(function);
+			if(consumed != 0)
+			{
+				on_batch(consumed);
+				idle.reset();
+			}
+			else if(finished)
+				return;
+			else
+			{
+				on_idle();
+				idle.idle();
+			}
+		}
+	}
+
+private:
+
+	std::vector<PipelineStage *> producers;
+	std::vector<SpscQueue<In> *> lanes;
+};
+
+template <class Out, typename Functor>
+class SourceStage : public PipelineStage
+{
+public:
+
+	SourceStage(const int _core, const Functor& _function, const std::atomic<bool>& _stopping,
+			const size_t queue_size, const PublishPolicy& policy)
+	: PipelineStage(_core)
+	, function(_function)
+	, stopping(_stopping)
+	, output(queue_size, policy)
+	{
+	}
+
+	void run() override
+	{
+		AdaptiveIdleStrategy idle;
+		bool more = true;
+		while(more && !stopping.load(MEM_RELAXED))
+		{
+			more = function(output);
+			const size_t emitted = output.takeEmitted();
+			if(emitted != 0)
+			{
+				countOut(emitted);
+				output.tick();
+				idle.reset();
+			}
+			else
+			{
+				output.flush();
+				idle.idle();
+			}
+		}
+		output.flush();
+		finish();
+	}
+
+	Functor function;
+	const std::atomic<bool>& stopping;
+	Emitter<Out> output;
+};
+
+template <class In, class Out, typename Functor>
+class ProcessingStage : public PipelineStage
+{
+public:
+
+	ProcessingStage(const int _core, const Functor& _function, const std::vector<StageHandle<In>>& handles,
+			const size_t queue_size, const PublishPolicy& policy)
+	: PipelineStage(_core)
+	, function(_function)
+	, inputs(handles)
+	, output(queue_size, policy)
+	{
+	}
+
+	void run() override
+	{
+		inputs.run([this](In&& element) {
+			function(std::move(element), output);
+		}, [this](const size_t consumed) {
+			countIn(consumed);
+			countOut(output.takeEmitted());
+			output.tick();
+		}, [this]() {
+			output.flush();
+		});
+		output.flush();
+		finish();
+	}
+
+	Functor function;
+	StageInputs<In> inputs;
+	Emitter<Out> output;
+};
+
+template <class In, typename Functor>
+class SinkStage : public PipelineStage
+{
+public:
+
+	SinkStage(const int _core, const Functor& _function, const std::vector<StageHandle<In>>& handles)
+	: PipelineStage(_core)
+	, function(_function)
+	, inputs(handles)
+	{
+	}
+
+	void run() override
+	{
+		inputs.run([this](In&& element) {
+			function(std::move(element));
+		}, [this](const size_t consumed) {
+			countIn(consumed);
+		}, []() {
+		});
+		finish();
+	}
+
+	Functor function;
+	StageInputs<In> inputs;
+};
+
+class Pipeline
+{
+public:
+
+	Pipeline(const size_t _queue_size = DEFAULT_PIPELINE_QUEUE_SIZE, const PublishPolicy& _policy = PublishPolicy())
+	: queue_size(_queue_size)
+	, policy(_policy)
+	, stopping(false)
+	{
+	}
+
+	Pipeline(Pipeline&) = delete;
+
+	~Pipeline()
+	{
+		stop();
+		join();
+	}
+
+	/*
+	 * function is called as bool(Emitter<Out>&) , it emits any number of elements and returns false once the
+	 * source is exhausted , core is the core the stage thread is pinned to or -1 to leave it unpinned
+	 */
+	template <class Out, typename Functor>
+	StageHandle<Out> source(const int core, const Functor& function)
+	{
+		auto * stage = new SourceStage<Out, Functor>(core, function, stopping, queue_size, policy);
+		stages.emplace_back(stage);
+		return StageHandle<Out>(stage, &stage->output);
+	}
+
+	//function is called as void(In&&, Emitter<Out>&) for every element of every input
+	template <class In, class Out, typename Functor>
+	StageHandle<Out> stage(const std::vector<StageHandle<In>>& inputs, const int core, const Functor& function)
+	{
+		auto * stage = new ProcessingStage<In, Out, Functor>(core, function, inputs, queue_size, policy);
+		stages.emplace_back(stage);
+		return StageHandle<Out>(stage, &stage->output);
+	}
+
+	template <class In, class Out, typename Functor>
+	StageHandle<Out> stage(const StageHandle<In>& input, const int core, const Functor& function)
+	{
+		return stage<In, Out>(std::vector<StageHandle<In>>{input}, core, function);
+	}
+
+	//function is called as void(In&&) for every element of every input
+	template <class In, typename Functor>
+	void sink(const std::vector<StageHandle<In>>& inputs, const int core, const Functor& function)
+	{
+		stages.emplace_back(new SinkStage<In, Functor>(core, function, inputs));
+	}
+
+	template <class In, typename Functor>
+	void sink(const StageHandle<In>& input, const int core, const Functor& function)
+	{
+		sink<In>(std::vector<StageHandle<In>>{input}, core, function);
+	}
+
+	/*
+	 * registers the counters prefix.stage<index>.in and prefix.stage<index>.out for every stage added so far , the
+	 * index is the order the stage was added in , should be called before start
+	 */
+	void exportMetrics(MetricsRegistry& registry, const std::string& prefix = "pipeline")
+	{
+		for(size_t i = 0; i < stages.size(); ++i)
+		{
+			const std::string name = prefix + ".stage" + std::to_string(i);
+			stages[i]->exportTo(&registry.counter(name + ".in"), &registry.counter(name + ".out"));
+		}
+	}
+
+	/*
+	 * the graph cannot change after start , every stage thread waits until all of them were pinned before running
+	 * throws PipelinePinFailed when a core cannot be used , no stage runs then since a stage whose consumer never
+	 * starts would block on its full lanes forever
+	 */
+	void start()
+	{
+		std::vector<std::promise<bool>> pinned(stages.size());
+		for(size_t i = 0; i < stages.size(); ++i)
+		{
+			PipelineStage * current = stages[i].get();
+			threads.emplace_back([current](std::future<bool> can_run) {
+				if(can_run.get())
+					current->run();
+			}, pinned[i].get_future());
+		}
+		bool result = true;
+		for(size_t i = 0; i < stages.size() && result; ++i)
+			result = pinThread(threads[i], stages[i]->core);
+		for(auto& promise : pinned)
+			promise.set_value(result);
+		if(unlikely(!result))
+		{
+			join();
+			threads.clear();
+			throw PipelinePinFailed();
+		}
+	}
+
+	//asks the sources to finish , the rest of the graph drains and finishes after them
+	void stop()
+	{
+		stopping.store(true, MEM_RELAXED);
+	}
+
+	void join()
+	{
+		for(auto& thread : threads)
+			if(thread.joinable())
+				thread.join();
+	}
+
+private:
+
+	//returns false when core is not a core the process may run on
+	static bool pinThread(std::thread& thread, const int core)
+	{
+		if(core < 0)
+			return true;
+		if(core >= CPU_SETSIZE)
+			return false;
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(core, &cpus);
+		return pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) == 0;
+	}
+
+	const size_t queue_size;
+	const PublishPolicy policy;
+	std::atomic<bool> stopping;
+	std::vector<std::unique_ptr<PipelineStage>> stages;
+	std::vector<std::thread> threads;
+};
+
+#endif
@@ -24,5 +24,21 @@ class QueueFull : public std::exception
 	}
 };
 
+class QueueSpillFailed : public std::exception
+{
+	const char * what() const noexcept override
+	{
+		return "queue could not create a spill segment file";
+	}
+};
+
+class PipelinePinFailed : public std::exception
+{
+	const char * what() const noexcept override
+	{
+		return "pipeline could not pin a stage thread to its core";
+	}
+};
+
 
 #endif /* QUEUE_EXCEPTIONS_H_ */
@@ -0,0 +1,165 @@
+#ifndef SHARDEDCOUNTER_H_
+#define SHARDEDCOUNTER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include "cyclic_buffer.h"
+
+#define DEFAULT_COUNTER_SHARDS 64
+
+/*
+ * an int64 split over cache line padded shards , every thread adds to the shard of its thread index so threads on
+ * different cores never write the same cache line , reading sums all the shards
+ * the sum is not a snapshot , adds that run during the read may or may not be in it
+ */
+class ShardedValue
+{
+public:
+
+	ShardedValue(const size_t _shards = DEFAULT_COUNTER_SHARDS)
+	: shards(roundShards(_shards))
+	, mask(shards - 1)
+	, slots(static_cast<Slot *>(::operator new(sizeof(Slot) * shards, std::align_val_t(CACHE_LINE_SIZE))))
+	{
+		for(size_t i = 0; i < shards; ++i)
+			new (&slots[i].value) std::atomic<int64_t>(0);
+	}
+
+	ShardedValue(ShardedValue&) = delete;
+
+	~ShardedValue()
+	{
+		::operator delete(slots, std::align_val_t(CACHE_LINE_SIZE));
+	}
+
+	void add(const int64_t amount)
+	{
+		slots[threadIndex() & mask].value.fetch_add(amount, MEM_RELAXED);
+	}
+
+	const int64_t sum() const
+	{
+		int64_t ret = 0;
+		for(size_t i = 0; i < shards; ++i)
+			ret += slots[i].value.load(MEM_RELAXED);
+		return ret;
+	}
+
+	//should not run together with add , an add that runs during reset may be lost
+	void reset()
+	{
+		for(size_t i = 0; i < shards; ++i)
+			slots[i].value.store(0, MEM_RELAXED);
+	}
+
+private:
+
+	struct Slot
+	{
+		std::atomic<int64_t> value;
+		char padding[CACHE_LINE_SIZE - sizeof(std::atomic<int64_t>)];
+	};
+
+	static const size_t roundShards(const size_t shards)
+	{
+		size_t ret = 1;
+		while(ret < shards)
+			ret *= 2;
+		return ret;
+	}
+
+	//threads get consecutive indexes so the first threads of the process never share a shard
+	static size_t threadIndex()
+	{
+		static std::atomic<size_t> next_index(0);
+		static thread_local size_t index = next_index.fetch_add(1, MEM_RELAXED);
+		return index;
+	}
+
+	const size_t shards;
+	const size_t mask;
+	Slot * const slots;
+};
+
+//a count that only grows , like messages or bytes passed through a queue
+class ShardedCounter
+{
+public:
+
+	ShardedCounter(const size_t shards = DEFAULT_COUNTER_SHARDS)
+	: value(shards)
+	{
+	}
+
+	void increment()
+	{
+		value.add(1);
+	}
+
+	void add(const uint64_t amount)
+	{
+		value.add(amount);
+	}
+
+	const uint64_t get() const
+	{
+		return value.sum();
+	}
+
+	void reset()
+	{
+		value.reset();
+	}
+
+private:
+
+	ShardedValue value;
+};
+
+//a level that goes up and down , like the elements waiting in a queue , a thread may decrement what another added
+class ShardedGauge
+{
+public:
+
+	ShardedGauge(const size_t shards = DEFAULT_COUNTER_SHARDS)
+	: value(shards)
+	{
+	}
+
+	void increment()
+	{
+		value.add(1);
+	}
+
+	void decrement()
+	{
+		value.add(-1);
+	}
+
+	void add(const int64_t amount)
+	{
+		value.add(amount);
+	}
+
+	void sub(const int64_t amount)
+	{
+		value.add(-amount);
+	}
+
+	const int64_t get() const
+	{
+		return value.sum();
+	}
+
+	void reset()
+	{
+		value.reset();
+	}
+
+private:
+
+	ShardedValue value;
+};
+
+#endif
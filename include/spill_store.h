@@ -0,0 +1,282 @@
+#ifndef SPILLSTORE_H_
+#define SPILLSTORE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "cyclic_buffer.h"
+
+#define DEFAULT_SPILL_SEGMENT_SIZE (64 * 1024 * 1024)
+
+/*
+ * turns an element into bytes for the spill segments , the default handles trivially copyable types
+ * a user serializer needs the same three functions and enabled set to true
+ */
+template <class T>
+struct SpillSerializer
+{
+	static const bool enabled = std::is_trivially_copyable<T>::value;
+
+	static const size_t size(const T&)
+	{
+		return sizeof(T);
+	}
+
+	static void serialize(const T& element, char * data)
+	{
+		memcpy(data, &element, sizeof(T));
+	}
+
+	static T deserialize(const char * data, const size_t)
+	{
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type element;
+		memcpy(&element, data, sizeof(T));
+		return *reinterpret_cast<T *>(&element);
+	}
+};
+
+struct SpillConfig
+{
+	SpillConfig(const size_t _max_memory_capacity, const std::string& _directory = "/tmp",
+			const size_t _segment_size = DEFAULT_SPILL_SEGMENT_SIZE)
+	: max_memory_capacity(_max_memory_capacity)
+	, directory(_directory)
+	, segment_size(_segment_size)
+	{
+	}
+
+	size_t max_memory_capacity; /* the ring grows up to this many elements , then pushes go to disk */
+	std::string directory;
+	size_t segment_size;
+};
+
+/*
+ * one append only memory mapped file , the file is unlinked as soon as it is mapped so its space goes back to the
+ * system when the segment is deleted and nothing is left behind after a crash
+ */
+struct SpillSegment
+{
+	SpillSegment()
+	: data(nullptr)
+	, capacity(0)
+	, published(0)
+	, next(nullptr)
+	{
+	}
+
+	SpillSegment(const std::string& directory, const size_t _capacity)
+	: data(nullptr)
+	, capacity(_capacity)
+	, published(0)
+	, next(nullptr)
+	{
+		std::string path = directory + "/spill-XXXXXX";
+		std::vector<char> name(path.begin(), path.end());
+		name.push_back('\0');
+		const int file = mkstemp(name.data());
+		if(file < 0)
+			throw QueueSpillFailed();
+		unlink(name.data());
+		if(ftruncate(file, capacity) != 0)
+		{
+			close(file);
+			throw QueueSpillFailed();
+		}
+		void * mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		close(file);
+		if(mapping == MAP_FAILED)
+			throw QueueSpillFailed();
+		data = static_cast<char *>(mapping);
+	}
+
+	SpillSegment(SpillSegment&) = delete;
+
+	~SpillSegment()
+	{
+		if(data != nullptr)
+			munmap(data, capacity);
+	}
+
+	char * data;
+	const size_t capacity;
+	std::atomic<size_t> published; /* bytes of whole records the consumer may read */
+	std::atomic<SpillSegment *> next;
+};
+
+/*
+ * single producer single consumer FIFO of serialized elements over a chain of spill segments
+ * every record is a 32 bit length followed by the serialized element , padded to 8 bytes
+ * the consumer deletes a segment once it read all of it and the producer already moved to the next one
+ * a producer that leaves the disk seals the tail segment so the consumer deletes it too instead of keeping it mapped
+ */
+template <class T, class Serializer = SpillSerializer<T>>
+class SpillStore
+{
+public:
+
+	SpillStore(const SpillConfig& _config)
+	: config(_config)
+	, read_segment(new SpillSegment())
+	, read_offset(0)
+	, local_consumed_records(0)
+	, consumed_records(0)
+	, write_segment(read_segment)
+	, write_offset(0)
+	, appended_records(0)
+	{
+	}
+
+	SpillStore(SpillStore&) = delete;
+
+	~SpillStore()
+	{
+		while(read_segment != nullptr)
+		{
+			SpillSegment * next = read_segment->next.load(MEM_RELAXED);
+			delete read_segment;
+			read_segment = next;
+		}
+	}
+
+	//should be only used by the producer
+	void append(const T& element)
+	{
+		const size_t size = Serializer::size(element);
+		const size_t record_size = recordSize(size);
+		if(unlikely(write_offset + record_size > write_segment->capacity))
+			addSegment(record_size);
+		char * record = write_segment->data + write_offset;
+		const uint32_t length = size;
+		memcpy(record, &length, sizeof(length));
+		Serializer::serialize(element, record + sizeof(length));
+		write_offset += record_size;
+		++appended_records;
+		write_segment->published.store(write_offset, MEM_RELEASE);
+	}
+
+	//should be only used by the producer , returns true when the consumer read every appended element
+	bool drained() const
+	{
+		return consumed_records.load(MEM_ACQUIRE) == appended_records;
+	}
+
+	/*
+	 * should be only used by the producer , links an empty segment after the tail so the consumer unmaps the tail on
+	 * its next read , the next append starts a new segment
+	 */
+	void seal()
+	{
+		if(write_segment->capacity == 0)
+			return;
+		SpillSegment * segment = new SpillSegment();
+		write_segment->next.store(segment, MEM_RELEASE);
+		write_segment = segment;
+		write_offset = 0;
+	}
+
+	//should be only used by the consumer , returns true when there is an element to read otherwise false
+	bool canRead()
+	{
+		size_t size;
+		return peek(size) != nullptr;
+	}
+
+	template <typename Functor>
+	bool consumeOne(const Functor& function)
+	{
+		size_t size;
+		const char * record = peek(size);
+		if(record == nullptr)
+			return false;
+		function(Serializer::deserialize(record, size));
+		advance(size);
+		return true;
+	}
+
+	template <typename Functor>
+	bool popOnSuccses(const Functor& function)
+	{
+		size_t size;
+		const char * record = peek(size);
+		if(record == nullptr)
+			return false;
+		const T element = Serializer::deserialize(record, size);
+		if(!function(element))
+			return false;
+		advance(size);
+		return true;
+	}
+
+	template <typename Functor>
+	size_t consumeAll(const Functor& function)
+	{
+		size_t consumed = 0;
+		while(consumeOne(function))
+			++consumed;
+		return consumed;
+	}
+
+private:
+
+	static const size_t recordSize(const size_t size)
+	{
+		return (sizeof(uint32_t) + size + 7) & ~size_t(7);
+	}
+
+	void addSegment(const size_t record_size)
+	{
+		SpillSegment * segment = new SpillSegment(config.directory, std::max(config.segment_size, record_size));
+		write_segment->next.store(segment, MEM_RELEASE);
+		write_segment = segment;
+		write_offset = 0;
+	}
+
+	const char * peek(size_t& size)
+	{
+		while(true)
+		{
+			if(read_offset < read_segment->published.load(MEM_ACQUIRE))
+			{
+				uint32_t length;
+				memcpy(&length, read_segment->data + read_offset, sizeof(length));
+				size = length;
+				return read_segment->data + read_offset + sizeof(length);
+			}
+			SpillSegment * next = read_segment->next.load(MEM_ACQUIRE);
+			if(next == nullptr)
+				return nullptr;
+			//the producer publishes the last record of a segment before linking the next one
+			if(read_offset < read_segment->published.load(MEM_ACQUIRE))
+				continue;
+			delete read_segment;
+			read_segment = next;
+			read_offset = 0;
+		}
+	}
+
+	void advance(const size_t size)
+	{
+		read_offset += recordSize(size);
+		consumed_records.store(++local_consumed_records, MEM_RELEASE);
+	}
+
+	const SpillConfig config;
+
+	SpillSegment * read_segment;
+	size_t read_offset;
+	size_t local_consumed_records;
+	std::atomic<size_t> consumed_records;
+	char padding1[CACHE_LINE_SIZE]; /* force the consumer fields and the producer fields to different cache lines */
+	SpillSegment * write_segment;
+	size_t write_offset;
+	size_t appended_records;
+};
+
+#endif
@@ -8,8 +8,8 @@ class SpscQueue
 {
 public:
 
-	SpscQueue(const std::size_t _queue_size)
-	:queue(_queue_size)
+	SpscQueue(const std::size_t _queue_size, const PublishPolicy& _policy = PublishPolicy())
+	:queue(_queue_size, _policy)
 	{
 	}
 
@@ -52,18 +52,57 @@ public:
 		return queue.popOnSuccses(function);
 	}
 	
+	//returns true when an element was popped and handed to function otherwise false
 	template<typename Functor>
-	void consumeOne(const Functor& function)
+	bool consumeOne(const Functor& function)
 	{
-		queue.consumeOne(function);
+		return queue.consumeOne(function);
 	}
 
 	template<typename Functor>
-	void consumeAll(const Functor& function)
+	size_t consumeAll(const Functor& function)
 	{
-		queue.consumeAll(function);
+		return queue.consumeAll(function);
+	}
+
+	template<typename Functor>
+	size_t consumeUpTo(const size_t max, const Functor& function)
+	{
+		return queue.consumeUpTo(max, function);
+	}
+
+	template<typename Functor>
+	size_t consumeFor(const std::chrono::nanoseconds budget, const Functor& function)
+	{
+		return queue.consumeFor(budget, function);
 	}
 	
+#if __cplusplus >= 202002L
+	template<typename Functor>
+	size_t consumeSpan(const Functor& function)
+	{
+		return queue.consumeSpan(function);
+	}
+#endif
+
+	//should be only used by the producer , publishes every staged element to the consumer
+	void flush()
+	{
+		queue.flush();
+	}
+
+	//should be only used by the producer , publishes the staged elements once the oldest waited max_publish_delay
+	void tick()
+	{
+		queue.tick();
+	}
+
+	//should be only used by the consumer , gives every consumed slot back to the producer
+	void releaseReads()
+	{
+		queue.releaseReads();
+	}
+
 	//should be only used by the consumer , returns true when the queue isnt empty otherwise false
 	bool canRead() const
 	{
@@ -0,0 +1,198 @@
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "growing_spsc_queue.h"
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+/*
+ * hierarchical timer wheel , every producer thread owns one lane of the inbox (a GrowingSpscQueue) so scheduling
+ * never blocks and never fails , the owner thread drains the lanes and advances the wheel in advance()
+ * deadlines are absolute ticks , the conversion from time to ticks is up to the user
+ */
+template <class T>
+class TimerWheel
+{
+public:
+
+	TimerWheel(const size_t producers_count, const uint64_t start_tick = 0)
+	: current_tick(start_tick)
+	, pending_count(0)
+	{
+		lanes.reserve(producers_count);
+		for(size_t i = 0; i < producers_count; ++i)
+			lanes.emplace_back(new GrowingSpscQueue<TimerEntry>());
+		for(int level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+			occupied[level] = 0;
+	}
+
+	TimerWheel(TimerWheel<T>&) = delete;
+	TimerWheel(TimerWheel<T>&&) = default;
+
+	/*
+	 * should be only used by the producer that owns the lane , every lane must have a single producer thread
+	 */
+	void schedule(const size_t producer, const uint64_t deadline, const T& element)
+	{
+		lanes[producer]->push(TimerEntry{deadline, element});
+	}
+
+	void schedule(const size_t producer, const uint64_t deadline, T&& element)
+	{
+		lanes[producer]->push(TimerEntry{deadline, std::move(element)});
+	}
+
+	/*
+	 * should be only used by the owner thread , fires every timer with deadline <= now_tick through function
+	 * and returns the number of fired timers , function receives T&& like consumeAll
+	 */
+	template <typename Functor>
+	size_t advance(const uint64_t now_tick, const Functor& function)
+	{
+		size_t fired = drainInbox(function);
+		while(current_tick <= now_tick)
+		{
+			if(unlikely(pending_count == 0))
+			{
+				current_tick = now_tick + 1;
+				break;
+			}
+			if((current_tick & (TIMER_WHEEL_SLOTS - 1)) == 0)
+				cascade();
+			fired += fireSlot(current_tick & (TIMER_WHEEL_SLOTS - 1), function);
+			current_tick = nextTick(now_tick);
+		}
+		return fired;
+	}
+
+	//should be only used by the owner thread , the next tick that advance will process
+	const uint64_t currentTick() const
+	{
+		return current_tick;
+	}
+
+	//should be only used by the owner thread , timers that are already inside the wheel
+	const size_t pending() const
+	{
+		return pending_count;
+	}
+
+private:
+
+	struct TimerEntry
+	{
+		uint64_t deadline;
+		T element;
+	};
+
+	using Slot = std::vector<TimerEntry>;
+
+	template <typename Functor>
+	size_t drainInbox(const Functor& function)
+	{
+		size_t fired = 0;
+		for(auto& lane : lanes)
+		{
+			lane->consumeAll([&](TimerEntry&& entry) {
+				if(entry.deadline < current_tick)
+				{
+					function(std::move(entry.element));
+					++fired;
+				}
+				else
+					insert(std::move(entry));
+			});
+		}
+		return fired;
+	}
+
+	void insert(TimerEntry&& entry)
+	{
+		++pending_count;
+		const uint64_t difference = entry.deadline ^ current_tick;
+		const int level = difference == 0 ? 0 : (63 - __builtin_clzll(difference)) / TIMER_WHEEL_SLOT_BITS;
+		if(unlikely(level >= TIMER_WHEEL_LEVELS))
+		{
+			overflow.push_back(std::move(entry));
+			return;
+		}
+		const size_t slot = (entry.deadline >> (level * TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+		wheel[level][slot].push_back(std::move(entry));
+		occupied[level] |= uint64_t(1) << slot;
+	}
+
+	/*
+	 * called at the start of every level 0 revolution , higher levels are cascaded first so their entries
+	 * can trickle down more than one level in the same tick
+	 */
+	void cascade()
+	{
+		int top_level = 1;
+		while(top_level < TIMER_WHEEL_LEVELS &&
+				(current_tick & ((uint64_t(1) << (top_level * TIMER_WHEEL_SLOT_BITS)) - 1)) == 0)
+			++top_level;
+		if(top_level == TIMER_WHEEL_LEVELS &&
+				(current_tick & ((uint64_t(1) << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1)) == 0)
+			reinsert(overflow);
+		for(int level = top_level - 1; level > 0; --level)
+		{
+			const size_t slot = (current_tick >> (level * TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+			occupied[level] &= ~(uint64_t(1) << slot);
+			reinsert(wheel[level][slot]);
+		}
+	}
+
+	void reinsert(Slot& slot)
+	{
+		if(slot.empty())
+			return;
+		Slot entries;
+		entries.swap(slot);
+		pending_count -= entries.size();
+		for(auto& entry : entries)
+			insert(std::move(entry));
+		entries.clear();
+		if(slot.empty())
+			slot.swap(entries);
+	}
+
+	template <typename Functor>
+	size_t fireSlot(const size_t slot_index, const Functor& function)
+	{
+		Slot& slot = wheel[0][slot_index];
+		const size_t fired = slot.size();
+		if(fired == 0)
+			return 0;
+		for(auto& entry : slot)
+			function(std::move(entry.element));
+		slot.clear();
+		occupied[0] &= ~(uint64_t(1) << slot_index);
+		pending_count -= fired;
+		return fired;
+	}
+
+	//skips the rest of the level 0 revolution when none of its remaining slots hold a timer
+	const uint64_t nextTick(const uint64_t now_tick) const
+	{
+		const uint64_t next = current_tick + 1;
+		const size_t next_slot = next & (TIMER_WHEEL_SLOTS - 1);
+		if(next_slot == 0 || (occupied[0] >> next_slot) != 0)
+			return next;
+		const uint64_t revolution_end = (next | (TIMER_WHEEL_SLOTS - 1)) + 1;
+		return revolution_end <= now_tick ? revolution_end : now_tick + 1;
+	}
+
+	std::vector<std::unique_ptr<GrowingSpscQueue<TimerEntry>>> lanes;
+	Slot wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	uint64_t occupied[TIMER_WHEEL_LEVELS];
+	Slot overflow;
+	uint64_t current_tick;
+	size_t pending_count;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <sys/resource.h>
+#include "concurrent_hash_map.h"
+
+int operations = 4000000;
+int keys_range = 1 << 16;
+int write_percent = 10;
+int churn_rounds = 400;
+int churn_keys = 30000;
+
+class LockedMap
+{
+public:
+
+	bool insert(const int key, const int value)
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		return map.insert_or_assign(key, value).second;
+	}
+
+	bool erase(const int key)
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		return map.erase(key) != 0;
+	}
+
+	bool find(const int key, int& value)
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		auto it = map.find(key);
+		if(it == map.end())
+			return false;
+		value = it->second;
+		return true;
+	}
+
+private:
+
+	std::mutex locker;
+	std::unordered_map<int, int> map;
+};
+
+template<typename MapType>
+void worker(MapType& map, const int thread_operations, const int seed)
+{
+	std::minstd_rand random(seed);
+	int value = 0;
+	for(int i = 0; i < thread_operations; ++i)
+	{
+		const int key = random() % keys_range;
+		const int action = random() % 100;
+		if(action < write_percent / 2)
+			map.insert(key, i);
+		else if(action < write_percent)
+			map.erase(key);
+		else
+			map.find(key, value);
+	}
+}
+
+template<typename MapType>
+long long run(MapType& map, const int threads_count)
+{
+	for(int key = 0; key < keys_range; key += 2)
+		map.insert(key, key);
+	std::vector<std::thread> threads;
+	auto start = std::chrono::high_resolution_clock::now();
+	for(int i = 0; i < threads_count; ++i)
+		threads.emplace_back(worker<MapType>, std::ref(map), operations / threads_count, i + 1);
+	for(auto& thread : threads)
+		thread.join();
+	auto elapsed = std::chrono::high_resolution_clock::now() - start;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+long maxResidentKilobytes()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/*
+ * erases and inserts new keys with a flat size , every few rounds the map migrates to a new table , the replaced
+ * tables must be freed on the way so the memory after the warm up rounds must not keep growing
+ */
+bool churn()
+{
+	ConcurrentHashMap<int, int> map(1 << 16);
+	for(int key = 0; key < churn_keys; ++key)
+		map.insert(key, key);
+	long warm_kilobytes = 0;
+	for(int round = 0; round < churn_rounds; ++round)
+	{
+		for(int key = 0; key < churn_keys; ++key)
+		{
+			map.erase(round * churn_keys + key);
+			map.insert((round + 1) * churn_keys + key, key);
+		}
+		if(round == churn_rounds / 8)
+			warm_kilobytes = maxResidentKilobytes();
+	}
+	const long kilobytes = maxResidentKilobytes();
+	const long table_kilobytes = map.capacity() * sizeof(int) * 4 / 1024;
+	std::cout << "churn max resident kilobytes after warm up : " << warm_kilobytes << " at the end : " << kilobytes
+			<< " capacity : " << map.capacity() << std::endl;
+	return kilobytes - warm_kilobytes <= 4 * table_kilobytes;
+}
+
+int main()
+{
+	if(!churn())
+	{
+		std::cout << "replaced tables are not freed" << std::endl;
+		return 1;
+	}
+	const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+	for(int threads_count = 1; threads_count <= max_threads; threads_count *= 2)
+	{
+		LockedMap locked_map;
+		ConcurrentHashMap<int, int> concurrent_map;
+
+		long long locked_nanoseconds = run(locked_map, threads_count);
+		long long concurrent_nanoseconds = run(concurrent_map, threads_count);
+
+		std::cout << "threads : " << threads_count << std::endl;
+		std::cout << "mutex unordered_map time it takes for one operation in nano seconds : "
+				<< (locked_nanoseconds / operations) << std::endl;
+		std::cout << "ConcurrentHashMap time it takes for one operation in nano seconds : "
+				<< (concurrent_nanoseconds / operations) << std::endl;
+	}
+}
@@ -0,0 +1,155 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <immintrin.h>
+#include "spsc_queue.h"
+
+/*
+ * compares draining ticks one element at a time with consumeAll against handing the ring memory to SIMD kernels
+ * with consumeSpan , needs c++20 for std::span
+ */
+
+const size_t size = 50000000;
+std::vector<uint64_t> copied(size);
+
+uint64_t sumScalar(std::span<const uint64_t> ticks)
+{
+	uint64_t sum = 0;
+	for(const uint64_t tick : ticks)
+		sum += tick;
+	return sum;
+}
+
+__attribute__((target("sse2")))
+uint64_t sumSse(std::span<const uint64_t> ticks)
+{
+	__m128i sum = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 2 <= ticks.size(); i += 2)
+		sum = _mm_add_epi64(sum, _mm_loadu_si128(reinterpret_cast<const __m128i *>(&ticks[i])));
+	uint64_t lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), sum);
+	return lanes[0] + lanes[1] + sumScalar(ticks.subspan(i));
+}
+
+__attribute__((target("avx2")))
+uint64_t sumAvx2(std::span<const uint64_t> ticks)
+{
+	__m256i sum = _mm256_setzero_si256();
+	size_t i = 0;
+	for(; i + 4 <= ticks.size(); i += 4)
+		sum = _mm256_add_epi64(sum, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&ticks[i])));
+	uint64_t lanes[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), sum);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumScalar(ticks.subspan(i));
+}
+
+//copies the ticks above threshold out of the ring
+__attribute__((target("avx2")))
+size_t filterAvx2(std::span<const uint64_t> ticks, const uint64_t threshold, uint64_t * out)
+{
+	const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+	const __m256i limit = _mm256_xor_si256(_mm256_set1_epi64x(threshold), bias);
+	size_t count = 0;
+	size_t i = 0;
+	for(; i + 4 <= ticks.size(); i += 4)
+	{
+		const __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&ticks[i]));
+		const int mask = _mm256_movemask_pd(_mm256_castsi256_pd(
+				_mm256_cmpgt_epi64(_mm256_xor_si256(values, bias), limit)));
+		if(mask == 0xf)
+		{
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(&out[count]), values);
+			count += 4;
+		}
+		else
+		{
+			for(int lane = 0; lane < 4; ++lane)
+				if(mask & (1 << lane))
+					out[count++] = ticks[i + lane];
+		}
+	}
+	for(; i < ticks.size(); ++i)
+		if(ticks[i] > threshold)
+			out[count++] = ticks[i];
+	return count;
+}
+
+template<typename QueueType>
+void writer(QueueType& queue)
+{
+	for(size_t j = 0; j < size; ++j)
+		while(!queue.push(j));
+}
+
+template<typename Drain>
+long long run(const Drain& drain)
+{
+	SpscQueue<uint64_t> queue(4096);
+	std::thread t1(writer<decltype(queue)>, std::ref(queue));
+	auto start = std::chrono::high_resolution_clock::now();
+	for(size_t consumed = 0; consumed < size; )
+		consumed += drain(queue);
+	t1.join();
+	auto elapsed = std::chrono::high_resolution_clock::now() - start;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+void report(const char * name, const long long nanoseconds, const uint64_t result)
+{
+	std::cout << name << " time it takes for one var in pico seconds : " << (nanoseconds * 1000 / size)
+			<< " result : " << result << std::endl;
+}
+
+int main()
+{
+	const uint64_t expected = uint64_t(size) * (size - 1) / 2;
+	uint64_t sum = 0;
+	size_t filtered = 0;
+
+	long long nanoseconds = run([&](SpscQueue<uint64_t>& queue) {
+		size_t consumed = 0;
+		queue.consumeAll([&](uint64_t&& tick) {
+			sum += tick;
+			++consumed;
+		});
+		return consumed;
+	});
+	report("consumeAll scalar sum", nanoseconds, sum == expected);
+
+	sum = 0;
+	nanoseconds = run([&](SpscQueue<uint64_t>& queue) {
+		return queue.consumeSpan([&](std::span<const uint64_t> ticks) {
+			sum += sumScalar(ticks);
+		});
+	});
+	report("consumeSpan scalar sum", nanoseconds, sum == expected);
+
+	sum = 0;
+	nanoseconds = run([&](SpscQueue<uint64_t>& queue) {
+		return queue.consumeSpan([&](std::span<const uint64_t> ticks) {
+			sum += sumSse(ticks);
+		});
+	});
+	report("consumeSpan sse2 sum", nanoseconds, sum == expected);
+
+	if(!__builtin_cpu_supports("avx2"))
+		return 0;
+
+	sum = 0;
+	nanoseconds = run([&](SpscQueue<uint64_t>& queue) {
+		return queue.consumeSpan([&](std::span<const uint64_t> ticks) {
+			sum += sumAvx2(ticks);
+		});
+	});
+	report("consumeSpan avx2 sum", nanoseconds, sum == expected);
+
+	nanoseconds = run([&](SpscQueue<uint64_t>& queue) {
+		return queue.consumeSpan([&](std::span<const uint64_t> ticks) {
+			filtered += filterAvx2(ticks, size / 2, &copied[filtered]);
+		});
+	});
+	report("consumeSpan avx2 filter copy-out", nanoseconds, filtered == size - size / 2 - 1);
+}
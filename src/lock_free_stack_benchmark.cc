@@ -0,0 +1,82 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include "lock_free_stack.h"
+
+int operations = 8000000;
+int max_threads = 32;
+
+class LockedStack
+{
+public:
+
+	void push(const int element)
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		stack.push_back(element);
+	}
+
+	bool tryPop(int& element)
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		if(stack.empty())
+			return false;
+		element = stack.back();
+		stack.pop_back();
+		return true;
+	}
+
+private:
+
+	std::mutex locker;
+	std::vector<int> stack;
+};
+
+//every thread pushes and pops in turns , like threads sharing a work stack or a free list
+template<typename StackType>
+void worker(StackType& stack, const int thread_operations)
+{
+	int element;
+	for(int i = 0; i < thread_operations; i += 2)
+	{
+		stack.push(i);
+		stack.tryPop(element);
+	}
+}
+
+template<typename StackType>
+long long run(StackType& stack, const int threads_count)
+{
+	std::vector<std::thread> threads;
+	auto start = std::chrono::high_resolution_clock::now();
+	for(int i = 0; i < threads_count; ++i)
+		threads.emplace_back(worker<StackType>, std::ref(stack), operations / threads_count);
+	for(auto& thread : threads)
+		thread.join();
+	auto elapsed = std::chrono::high_resolution_clock::now() - start;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+int main()
+{
+	for(int threads_count = 1; threads_count <= max_threads; threads_count *= 2)
+	{
+		LockedStack locked_stack;
+		LockFreeStack<int> lock_free_stack;
+		LockFreeStack<int> no_elimination_stack(0);
+
+		long long locked_nanoseconds = run(locked_stack, threads_count);
+		long long lock_free_nanoseconds = run(lock_free_stack, threads_count);
+		long long no_elimination_nanoseconds = run(no_elimination_stack, threads_count);
+
+		std::cout << "threads : " << threads_count << std::endl;
+		std::cout << "mutex vector time it takes for one operation in nano seconds : "
+				<< (locked_nanoseconds / operations) << std::endl;
+		std::cout << "LockFreeStack time it takes for one operation in nano seconds : "
+				<< (lock_free_nanoseconds / operations) << std::endl;
+		std::cout << "LockFreeStack without elimination time it takes for one operation in nano seconds : "
+				<< (no_elimination_nanoseconds / operations) << std::endl;
+	}
+}